@@ -28,6 +28,7 @@
     Copyright 2007 David Elliott
  */
 
+#include <kern/clock.h>
 #include "AppleACPIPS2Nub.h"
 
 #if 0
@@ -105,23 +106,73 @@ bool AppleACPIPS2Nub::start(IOService *provider)
     return true;
 }
 
-IOService *AppleACPIPS2Nub::findMouseDevice()
+static IORegistryEntry *searchACPIPlane(IORegistryEntry *scope, OSObject *names)
 {
-    OSObject *prop = getProperty("MouseNameMatch");
-    /* Search from the root of the ACPI plane for the mouse PNP nub */
-    IORegistryIterator *i = IORegistryIterator::iterateOver(gIOACPIPlane, kIORegistryIterateRecursively);
-    IORegistryEntry *entry;
+    /* Walk the ACPI plane below scope (all of it if NULL) for the first entry matching names */
+    IORegistryIterator *i;
+    if(scope != NULL)
+        i = IORegistryIterator::iterateOver(scope, gIOACPIPlane, kIORegistryIterateRecursively);
+    else
+        i = IORegistryIterator::iterateOver(gIOACPIPlane, kIORegistryIterateRecursively);
+    IORegistryEntry *entry = NULL;
     if(i != NULL)
     {
         while((entry = i->getNextObject()))
         {
-            if(entry->compareNames(prop))
+            if(entry->compareNames(names))
                 break;
         }
         i->release();
     }
-    else
-        entry = NULL;
+    return entry;
+}
+
+IOService *AppleACPIPS2Nub::findMouseDevice()
+{
+    OSObject *prop = getProperty("MouseNameMatch");
+    IORegistryEntry *entry = NULL;
+    const char *method = NULL;
+    uint64_t start, end;
+    clock_get_uptime(&start);
+
+    /* A path resolved on an earlier boot (MousePath copied into the personality) */
+    if(OSString *path = OSDynamicCast(OSString, getProperty("MousePath")))
+    {
+        entry = IORegistryEntry::fromPath(path->getCStringNoCopy(), gIOACPIPlane);
+        if(entry != NULL)
+        {
+            bool match = entry->compareNames(prop);
+            entry->release();   /* the registry still holds it */
+            if(match)
+                method = "cached";
+            else
+                entry = NULL;
+        }
+    }
+
+    /* The mouse is almost always declared next to the keyboard, so search its scope first */
+    if(entry == NULL && getProvider() != NULL)
+    {
+        IORegistryEntry *scope = getProvider()->getParentEntry(gIOACPIPlane);
+        if(scope != NULL && (entry = searchACPIPlane(scope, prop)))
+            method = "scope";
+    }
+
+    /* Search from the root of the ACPI plane for the mouse PNP nub */
+    if(entry == NULL && (entry = searchACPIPlane(NULL, prop)))
+        method = "global";
+
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - start, &end);
+    setProperty("MouseLookupTime", (UInt32)(end / 1000), 32);
+    if(entry != NULL)
+    {
+        char path[512];
+        int len = sizeof(path);
+        if(entry->getPath(path, &len, gIOACPIPlane))
+            setProperty("MousePath", path);
+        setProperty("MouseLookupMethod", method);
+    }
     return OSDynamicCast(IOService, entry);
 }
 
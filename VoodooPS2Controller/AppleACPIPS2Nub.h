@@ -89,6 +89,11 @@ public:
 
     /*! @method     findMouseDevice
         @abstract   Locates the mouse nub in the IORegistry
+        @discussion
+        Tries the ACPI path in MousePath first, then the keyboard's ACPI scope,
+        then the whole ACPI plane.  The path found is published as MousePath
+        (copy it into the personality to skip the search on later boots),
+        along with MouseLookupMethod and MouseLookupTime (microseconds).
      */
     virtual IOService *findMouseDevice();
 
@@ -153,3 +153,10 @@ void ApplePS2Device::dispatchKeyboardMessage(int message, void *data)
     _controller->dispatchMessage(kDT_Keyboard, message, data);
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+PS2TelemetryRing* ApplePS2Device::getTelemetry()
+{
+    return _controller->getTelemetry();
+}
+
@@ -27,7 +27,10 @@
 #include <kern/queue.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOLib.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
 #include <architecture/i386/pio.h>
+#include "PS2Telemetry.h"
 
 #ifdef DEBUG_MSG
 #define DEBUG_LOG(args...)  do { IOLog(args); } while (0)
@@ -250,6 +253,139 @@ public:
     }
 };
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2EventLog
+//
+// Binary event log for input hot paths, used instead of IOLog there.
+//
+// Logging an event is a few stores into a fixed-size record and is safe in
+// the real interrupt routine.  Each site (a printf format with up to four
+// integer arguments) has a limit of records per second; events past the
+// limit are only counted.  Nothing is formatted until publish() is called,
+// normally when user space asks for it through setProperties.
+//
+// The ring keeps the most recent N records.  Records still being written
+// when publish() runs are skipped.
+//
+
+struct PS2EventLogSite
+{
+    const char* format;
+    UInt32 limit;
+};
+
+template <unsigned N>
+class PS2EventLog
+{
+private:
+    enum { kMaxSites = 16 };
+    struct Record
+    {
+        uint64_t time;
+        volatile UInt32 seq;    // index + 1 once the record is complete
+        UInt32 site;
+        UInt32 arg[4];
+    };
+    const PS2EventLogSite* m_sites;
+    unsigned m_siteCount;
+    uint64_t m_second;
+    volatile SInt32 m_count[kMaxSites];
+    volatile SInt32 m_suppressed[kMaxSites];
+    UInt32 m_windowCount[kMaxSites];
+    uint64_t m_windowStart[kMaxSites];
+    volatile SInt32 m_head;
+    Record m_ring[N];
+    
+public:
+    void init(const PS2EventLogSite* sites, unsigned count)
+    {
+        m_sites = sites;
+        m_siteCount = count < kMaxSites ? count : kMaxSites;
+        nanoseconds_to_absolutetime(1000000000ULL, &m_second);
+        bzero((void*)m_count, sizeof(m_count));
+        bzero((void*)m_suppressed, sizeof(m_suppressed));
+        bzero(m_windowCount, sizeof(m_windowCount));
+        bzero(m_windowStart, sizeof(m_windowStart));
+        bzero(m_ring, sizeof(m_ring));
+        m_head = 0;
+    }
+    void log(unsigned site, UInt32 a0 = 0, UInt32 a1 = 0, UInt32 a2 = 0, UInt32 a3 = 0)
+    {
+        if (site >= m_siteCount)
+            return;
+        uint64_t now;
+        clock_get_uptime(&now);
+        OSIncrementAtomic(&m_count[site]);
+        // per-site rate limit (approximate if two contexts race, which is fine)
+        if (now - m_windowStart[site] >= m_second)
+        {
+            m_windowStart[site] = now;
+            m_windowCount[site] = 0;
+        }
+        if (m_windowCount[site]++ >= m_sites[site].limit)
+        {
+            OSIncrementAtomic(&m_suppressed[site]);
+            return;
+        }
+        UInt32 index = (UInt32)OSIncrementAtomic(&m_head);
+        Record& r = m_ring[index % N];
+        r.seq = 0;
+        r.time = now;
+        r.site = site;
+        r.arg[0] = a0; r.arg[1] = a1; r.arg[2] = a2; r.arg[3] = a3;
+        OSMemoryBarrier();
+        r.seq = index + 1;
+    }
+    inline UInt32 count(unsigned site) { return site < m_siteCount ? m_count[site] : 0; }
+    void publish(IOService* service)
+    {
+        //
+        // Format the ring and the per-site counters as "EventLog" and
+        // "EventLogCounts" properties of the given service.
+        //
+        
+        char line[160];
+        UInt32 head = (UInt32)m_head;
+        UInt32 first = head > N ? head - N : 0;
+        OSArray* records = OSArray::withCapacity(N);
+        OSArray* counts = OSArray::withCapacity(m_siteCount);
+        if (!records || !counts)
+        {
+            OSSafeReleaseNULL(records);
+            OSSafeReleaseNULL(counts);
+            return;
+        }
+        for (UInt32 index = first; index < head; index++)
+        {
+            Record& r = m_ring[index % N];
+            if (r.seq != index + 1)
+                continue;
+            uint64_t ns;
+            absolutetime_to_nanoseconds(r.time, &ns);
+            int len = snprintf(line, sizeof(line), "%llu.%06llu ", ns / 1000000000ULL, (ns / 1000) % 1000000);
+            snprintf(line + len, sizeof(line) - len, m_sites[r.site].format, r.arg[0], r.arg[1], r.arg[2], r.arg[3]);
+            if (OSString* str = OSString::withCString(line))
+            {
+                records->setObject(str);
+                str->release();
+            }
+        }
+        for (unsigned site = 0; site < m_siteCount; site++)
+        {
+            snprintf(line, sizeof(line), "%d (%d suppressed): %s", (int)m_count[site], (int)m_suppressed[site], m_sites[site].format);
+            if (OSString* str = OSString::withCString(line))
+            {
+                counts->setObject(str);
+                str->release();
+            }
+        }
+        service->setProperty("EventLog", records);
+        service->setProperty("EventLogCounts", counts);
+        records->release();
+        counts->release();
+    }
+};
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // PS/2 Command Primitives
 //
@@ -272,6 +408,46 @@ public:
 //    o  Description: Writes the byte in the In Field to the command port (64h).
 //    o  In Field:    Holds byte that should be written.
 //
+// o  kPS2C_WaitMouseReady:
+//    o  Description: Waits for the mouse to finish its power-on self-test,
+//                    either by seeing its BAT completion code (kSC_Reset) or
+//                    by getting an acknowledge for a probe command
+//                    (kDP_SetDefaultsAndDisable).  Polls with a short backoff
+//                    and fails the request if the deadline passes first.
+//    o  In Field:    Holds the deadline in milliseconds (inOrOut32).
+//    o  Out Field:   Holds the time actually waited, in microseconds, with
+//                    kPS2C_MouseReadyBAT set if the BAT completion code was
+//                    seen (the device went through power-on, whatever state
+//                    it was in before is gone).
+//
+// o  kPS2C_SetReadTimeout:
+//    o  Description: Sets how long the reads that follow in the same request
+//                    wait for their byte before giving up.  Use it to fail
+//                    fast on replies that may legitimately never come.  The
+//                    budget reverts to the default at the end of the request.
+//    o  In Field:    Holds the budget in milliseconds (inOrOut32), 0 for the
+//                    default.
+//
+// o  kPS2C_SendMouseCommandsAndCompareAck:
+//    o  Description: Sends count bytes from buffer to the mouse, each one
+//                    followed by a check for its acknowledge, as a series of
+//                    kPS2C_SendMouseCommandAndCompareAck would.  The request
+//                    is aborted at the first byte that is not acknowledged.
+//    o  In Field:    Holds the bytes (buffer) and how many (count).
+//    o  Out Field:   Holds how many bytes were acknowledged (count).
+//
+// o  kPS2C_ReadMouseDataPortBytes:
+//    o  Description: Reads count bytes off the mouse input stream into
+//                    buffer.  The request is aborted if a byte times out,
+//                    rather than paying the timeout for each remaining one.
+//    o  In Field:    Holds the destination (buffer) and how many (count).
+//    o  Out Field:   Holds how many bytes were read (count).
+//
+//    The buffer is the caller's, so it must stay valid until the request
+//    completes (trivially true with submitRequestAndBlock).
+//
+
+#define kPS2C_MouseReadyBAT            0x80000000 // (kPS2C_WaitMouseReady out field)
 
 enum PS2CommandEnum
 {
@@ -285,6 +461,10 @@ enum PS2CommandEnum
     kPS2C_FlushDataPort,
     kPS2C_SleepMS,
     kPS2C_ModifyCommandByte,
+    kPS2C_WaitMouseReady,
+    kPS2C_SetReadTimeout,
+    kPS2C_SendMouseCommandsAndCompareAck,
+    kPS2C_ReadMouseDataPortBytes,
 };
 typedef enum PS2CommandEnum PS2CommandEnum;
 
@@ -301,6 +481,11 @@ struct PS2Command
             UInt8 clearBits;
             UInt8 oldBits;
         };
+        struct
+        {
+            UInt8* buffer;
+            UInt8  count;
+        };
     };
 };
 typedef struct PS2Command PS2Command;
@@ -614,6 +799,10 @@ public:
     
     virtual void lock();
     virtual void unlock();
+    
+    // Telemetry ring shared with user space (NULL if not available)
+    
+    virtual PS2TelemetryRing* getTelemetry();
 };
 
 #if 0   // Note: Now using architecture/i386/pio.h (see above)
@@ -0,0 +1,271 @@
+//
+//  PS2Telemetry.h
+//  VoodooPS2Controller
+//
+//  Layout of the telemetry ring shared between the kexts and a user space
+//  monitor.  Plain types only, so it builds in the kernel, against IOKit in
+//  user space, and on other platforms (see PS2TelemetryMapFile).
+//
+
+#ifndef VoodooPS2Controller_PS2Telemetry_h
+#define VoodooPS2Controller_PS2Telemetry_h
+
+#include <string.h>
+#ifdef KERNEL
+#include <libkern/OSAtomic.h>
+#define PS2_TELEMETRY_CLAIM(p)      ((uint32_t)OSIncrementAtomic((volatile SInt32*)(p)))
+#define PS2_TELEMETRY_BARRIER()     OSMemoryBarrier()
+#else
+#include <stdint.h>
+#define PS2_TELEMETRY_CLAIM(p)      __sync_fetch_and_add((p), 1)
+#define PS2_TELEMETRY_BARRIER()     __sync_synchronize()
+#endif
+
+#define kPS2TelemetryMagic          0x50533254  // 'PS2T'
+#define kPS2TelemetryVersion        1
+#define kPS2TelemetryRecords        1024        // power of 2
+#define kPS2TelemetryMemoryType     0           // clientMemoryForType
+
+// who wrote the record
+enum
+{
+    kPS2TS_Controller,
+    kPS2TS_Keyboard,
+    kPS2TS_Trackpad,
+};
+
+// what happened, and what code/arg hold
+enum
+{
+    kPS2TE_Packet,      // arrival; code: packet kind, arg: first bytes
+    kPS2TE_Decode,      // code: fingers, arg: x, y, z, buttons
+    kPS2TE_Gesture,     // touch mode transition; code: new mode, arg: old mode, fingers
+    kPS2TE_Dispatch,    // code: buttons (0 for keys), arg: dx, dy, -, arrival to dispatch (abs)
+    kPS2TE_Drop,        // code: drop reason, arg: first bytes
+    kPS2TE_Reset,       // resetController; arg: time (us), timeouts, aux present
+    kPS2TE_Stall,       // lost interrupt recovered; arg: bytes drained
+    kPS2TE_Recovery,    // bad packet recovery step; code: level, arg: success
+};
+
+// kPS2TE_Drop reasons
+enum
+{
+    kPS2TD_BadPacket,
+    kPS2TD_NonDualPoint,
+    kPS2TD_Passthrough,
+    kPS2TD_KeyEaten,
+};
+
+// Keyboard records never carry the key (scan code, ADB code or up/down),
+// only when it was dispatched or dropped.
+
+struct PS2TelemetryRecord
+{
+    volatile uint32_t seq;      // claim index + 1 once complete, 0 while written
+    uint8_t  source;
+    uint8_t  event;
+    uint16_t code;
+    uint64_t time;              // mach absolute time (see timeNumer/timeDenom)
+    int32_t  arg[4];
+};
+
+//
+// Records are claimed with an atomic increment of head, so writers never
+// wait on each other or on readers.  A reader keeps its own position and
+// checks each record's seq, which also tells it when it has been lapped.
+// Writes are skipped altogether while no reader is attached.
+//
+
+struct PS2TelemetryRing
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t recordCount;
+    volatile uint32_t head;     // records claimed so far
+    volatile uint32_t readers;
+    uint32_t timeNumer;         // abs * timeNumer / timeDenom = ns
+    uint32_t timeDenom;
+    PS2TelemetryRecord records[kPS2TelemetryRecords];
+
+    void init(uint32_t numer, uint32_t denom)
+    {
+        memset(this, 0, sizeof(*this));
+        recordSize = sizeof(PS2TelemetryRecord);
+        recordCount = kPS2TelemetryRecords;
+        timeNumer = numer;
+        timeDenom = denom;
+        version = kPS2TelemetryVersion;
+        PS2_TELEMETRY_BARRIER();
+        magic = kPS2TelemetryMagic;
+    }
+
+    bool valid() const
+    {
+        return kPS2TelemetryMagic == magic && kPS2TelemetryVersion == version &&
+            sizeof(PS2TelemetryRecord) == recordSize && kPS2TelemetryRecords == recordCount;
+    }
+
+    inline bool enabled() const { return 0 != readers; }
+
+    void write(uint8_t source, uint8_t event, uint16_t code, uint64_t time,
+               int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0)
+    {
+        if (!readers)
+            return;
+        uint32_t index = PS2_TELEMETRY_CLAIM(&head);
+        PS2TelemetryRecord& r = records[index % kPS2TelemetryRecords];
+        r.seq = 0;
+        PS2_TELEMETRY_BARRIER();
+        r.source = source;
+        r.event = event;
+        r.code = code;
+        r.time = time;
+        r.arg[0] = a0;
+        r.arg[1] = a1;
+        r.arg[2] = a2;
+        r.arg[3] = a3;
+        PS2_TELEMETRY_BARRIER();
+        r.seq = index + 1;
+    }
+};
+
+struct PS2TelemetryReader
+{
+    uint32_t next;
+    uint32_t dropped;
+
+    // start with what is written from now on
+    void attach(const PS2TelemetryRing* ring) { next = ring->head; dropped = 0; }
+
+    // copies the next record to out, false if there is none (yet)
+    bool read(const PS2TelemetryRing* ring, PS2TelemetryRecord* out)
+    {
+        while (1)
+        {
+            uint32_t head = ring->head;
+            PS2_TELEMETRY_BARRIER();
+            if (next == head)
+                return false;
+            if (head - next > kPS2TelemetryRecords)
+            {
+                dropped += head - next - kPS2TelemetryRecords;
+                next = head - kPS2TelemetryRecords;
+            }
+            const PS2TelemetryRecord& r = ring->records[next % kPS2TelemetryRecords];
+            uint32_t seq = r.seq;
+            PS2_TELEMETRY_BARRIER();
+            if (seq != next + 1)
+            {
+                // still being written, or already written over
+                if (0 == seq || (int32_t)(seq - (next + 1)) < 0)
+                    return false;
+                ++dropped;
+                ++next;
+                continue;
+            }
+            out->source = r.source;
+            out->event = r.event;
+            out->code = r.code;
+            out->time = r.time;
+            out->arg[0] = r.arg[0];
+            out->arg[1] = r.arg[1];
+            out->arg[2] = r.arg[2];
+            out->arg[3] = r.arg[3];
+            PS2_TELEMETRY_BARRIER();
+            if (r.seq != seq)
+            {
+                // written over while copying
+                ++dropped;
+                ++next;
+                continue;
+            }
+            out->seq = seq;
+            ++next;
+            return true;
+        }
+    }
+};
+
+#ifndef KERNEL
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// File-backed stand-in for the shared memory.  A test producer creates the
+// file and writes records with PS2TelemetryRing::write, a reader maps the
+// same file; the reader code is then the same as against the kext.  Times
+// are whatever the producer uses; init(1, 1) means nanoseconds.
+//
+
+inline PS2TelemetryRing* PS2TelemetryMapFile(const char* path, bool create)
+{
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (fd < 0)
+        return NULL;
+    if (create && ftruncate(fd, sizeof(PS2TelemetryRing)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    void* p = mmap(NULL, sizeof(PS2TelemetryRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p)
+        return NULL;
+    PS2TelemetryRing* ring = (PS2TelemetryRing*)p;
+    if (create)
+    {
+        ring->init(1, 1);
+        ring->readers = 1;
+    }
+    else if (!ring->valid())
+    {
+        munmap(p, sizeof(PS2TelemetryRing));
+        return NULL;
+    }
+    return ring;
+}
+
+inline void PS2TelemetryUnmapFile(PS2TelemetryRing* ring)
+{
+    munmap(ring, sizeof(PS2TelemetryRing));
+}
+
+#ifdef __APPLE__
+
+#include <IOKit/IOKitLib.h>
+
+//
+// The real thing: opening ApplePS2Controller attaches a reader (and turns
+// the writes on) until the connection is closed.  The ring is mapped read
+// only.  Opening it needs administrator privileges.
+//
+
+inline const PS2TelemetryRing* PS2TelemetryMapService(io_connect_t* connect)
+{
+    io_service_t service = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceMatching("ApplePS2Controller"));
+    if (!service)
+        return NULL;
+    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, connect);
+    IOObjectRelease(service);
+    if (KERN_SUCCESS != kr)
+        return NULL;
+    mach_vm_address_t address = 0;
+    mach_vm_size_t size = 0;
+    kr = IOConnectMapMemory64(*connect, kPS2TelemetryMemoryType, mach_task_self(), &address, &size, kIOMapAnywhere);
+    const PS2TelemetryRing* ring = (const PS2TelemetryRing*)address;
+    if (KERN_SUCCESS != kr || size < sizeof(PS2TelemetryRing) || !ring->valid())
+    {
+        IOServiceClose(*connect);
+        return NULL;
+    }
+    return ring;
+}
+
+#endif // __APPLE__
+
+#endif // !KERNEL
+
+#endif // VoodooPS2Controller_PS2Telemetry_h
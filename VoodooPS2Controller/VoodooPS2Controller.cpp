@@ -27,6 +27,7 @@
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include "ApplePS2KeyboardDevice.h"
 #include "ApplePS2MouseDevice.h"
 #include "VoodooPS2Controller.h"
@@ -64,6 +65,7 @@ void ApplePS2Controller::interruptHandlerMouse(OSObject*, void* refCon, IOServic
     ApplePS2Controller* me = (ApplePS2Controller*)refCon;
     if (me->_ignoreInterrupts)
         return;
+    OSIncrementAtomic(&me->_interruptCount);
     
     //
     // Wake our workloop to service the interrupt.    This is an edge-triggered
@@ -85,6 +87,7 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
     ApplePS2Controller* me = (ApplePS2Controller*)refCon;
     if (me->_ignoreInterrupts)
         return;
+    OSIncrementAtomic(&me->_interruptCount);
     
 #if DEBUGGER_SUPPORT
     //
@@ -168,36 +171,118 @@ void ApplePS2Controller::onWatchdogTimer()
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2Controller::onStallTimer()
+{
+    //
+    // Hybrid polling.  The 8042 raises IRQ1/IRQ12 when a byte lands in its
+    // output buffer, and holds the next one back until that byte is read.
+    // Some platforms lose those edges under load, and then nothing arrives
+    // on either port until another interrupt happens to come in.  That
+    // looks like input that just stops, so every packet pushes this timer
+    // out by kStallCheckMS (see armStallTimer) and it only fires once the
+    // stream goes quiet.  If a byte is waiting then and stays there for a
+    // short tick without any interrupt, the edge was lost and we read it
+    // ourselves.  With nothing waiting the timer stays off until the next
+    // packet.
+    //
+    
+    if (!_hybridPolling)
+        return;
+    
+    uint64_t start, now;
+    clock_get_uptime(&start);
+    
+    SInt32 count = _interruptCount;
+    bool quiet = (count == _stallInterrupts);
+    _stallInterrupts = count;
+    if (!_hardwareOffline && !_ignoreInterrupts && (inb(kCommandPort) & kOutputReady))
+    {
+        if (quiet && _stallSuspect)
+        {
+            // still there, and no interrupt came: the edge was lost
+            UInt32 bytes = handleInterrupt(kDT_Mouse);   // (reads both streams)
+            _polledBytes += bytes;
+            ++_stallRecoveries;
+            if (_telemetry)
+                _telemetry->write(kPS2TS_Controller, kPS2TE_Stall, 0, start, bytes);
+            _stallSuspect = false;
+        }
+        else
+        {
+            // an interrupt may be on its way, look again shortly
+            _stallSuspect = true;
+        }
+        _stallTimer->setTimeoutMS(kStallPollMS);
+    }
+    else
+    {
+        _stallSuspect = false;
+        setProperty("HybridPollStalls", _stallRecoveries, 32);
+        setProperty("HybridPolledBytes", _polledBytes, 32);
+        setProperty("HybridPollTicks", _pollTicks, 32);
+        absolutetime_to_nanoseconds(_pollTime, &now);
+        setProperty("HybridPollTime", now / 1000, 64);
+    }
+    
+    clock_get_uptime(&now);
+    _pollTime += now - start;
+    ++_pollTicks;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::armStallTimer()
+{
+    // called from the workloop when a packet arrives: check once the stream stops
+    if (_hybridPolling && _stallTimer)
+    {
+        _stallInterrupts = _interruptCount;
+        _stallSuspect = false;
+        _stallTimer->setTimeoutMS(kStallCheckMS);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 #if !HANDLE_INTERRUPT_DATA_LATER
 
-void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
+UInt32 ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
 {
     ////IOLog("%s:handleInterrupt(%s)\n", getName(), deviceType == kDT_Keyboard ? "kDT_Keyboard" : deviceType == kDT_Watchdog ? "kDT_Watchdog" : "kDT_Mouse");
     
     // Loop only while there is data currently on the input stream.
+    //
+    // The stall timer also drains the port, from the workloop, and the
+    // drivers' interruptOccurred are not reentrant.  So there is one
+    // drainer at a time (_portDraining); whoever comes second leaves the
+    // bytes to it.  _portLock is only held while reading status and data,
+    // and while giving up the drain: that last look at the status is under
+    // the same hold, so a byte that landed meanwhile is not left behind.
     
     bool wakeMouse = false;
     bool wakeKeyboard = false;
+    UInt32 count = 0;
+    IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+    if (_portDraining)
+    {
+        IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+        return 0;
+    }
+    _portDraining = true;
     while (1)
     {
-        // while getting status and reading the port, no interrupts...
-        bool enable = ml_set_interrupts_enabled(false);
         IODelay(kDataDelay);
         UInt8 status = inb(kCommandPort);
         if (!(status & kOutputReady))
         {
             // no data available, so break out and return
-            ml_set_interrupts_enabled(enable);
             break;
         }
         
 #if WATCHDOG_TIMER
         // do not process mouse data in watchdog timer
         if (deviceType == kDT_Watchdog && (status & kMouseData))
-        {
-            ml_set_interrupts_enabled(enable);
             break;
-        }
 #endif
         
         // read the data
@@ -206,7 +291,8 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
         
         // now ok for interrupts, we have read status, and found data...
         // (it does not matter [too much] if keyboard data is delivered out of order)
-        ml_set_interrupts_enabled(enable);
+        IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+        ++count;
         
 #if WATCHDOG_TIMER
         //REVIEW: remove this debug eventually...
@@ -225,7 +311,10 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
             if (kPS2IR_packetReady == _dispatchDriverInterrupt(kDT_Keyboard, data))
                 wakeKeyboard = true;
         }
+        state = IOSimpleLockLockDisableInterrupt(_portLock);
     } // while (forever)
+    _portDraining = false;
+    IOSimpleLockUnlockEnableInterrupt(_portLock, state);
     
     // wake up workloop based mouse interrupt source if needed
     if (wakeMouse)
@@ -233,17 +322,19 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
     // wake up workloop based keyboard interrupt source if needed
     if (wakeKeyboard)
         _interruptSourceKeyboard->interruptOccurred(0, 0, 0);
+    return count;
 }
 
 #else // HANDLE_INTERRUPT_DATA_LATER
 
-void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
+UInt32 ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
 {
     ////IOLog("%s:handleInterrupt(%s)\n", getName(), deviceType == kDT_Keyboard ? "kDT_Keyboard" : deviceType == kDT_Watchdog ? "kDT_Watchdog" : "kDT_Mouse");
     
     // Loop only while there is data currently on the input stream.
     
     UInt8 status;
+    UInt32 count = 0;
     IODelay(kDataDelay);
     while ((status = inb(kCommandPort)) & kOutputReady)
     {
@@ -261,7 +352,9 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
 #endif
         dispatchDriverInterrupt(status & kMouseData ? kDT_Mouse : kDT_Keyboard, data);
         IODelay(kDataDelay);
+        ++count;
     }
+    return count;
 }
 
 #endif // HANDLE_INTERRUPT_DATA_LATER
@@ -344,6 +437,11 @@ bool ApplePS2Controller::init(OSDictionary* dict)
     _keyboardDevice = 0;
     
     _suppressTimeout = false;
+    _readTimeoutMS = kDataTimeoutMS;
+    _readTimedOut = false;
+    _readTimeouts = 0;
+    _auxPresent = true;
+    _resetTime = 0;
     
 #ifdef NEWIRQ
     _newIRQLayout = false;	// turbo
@@ -351,6 +449,9 @@ bool ApplePS2Controller::init(OSDictionary* dict)
     
     _wakedelay = 10;
     _mouseWakeFirst = false;
+    _wakeReadyTime = 0;
+    _wakeReadyTimeMax = 0;
+    _resumeTime = 0;
     _cmdGate = 0;
     
     _requestQueueLock = 0;
@@ -359,6 +460,19 @@ bool ApplePS2Controller::init(OSDictionary* dict)
 #if WATCHDOG_TIMER
     _watchdogTimer = 0;
 #endif
+    _hybridPolling = false;
+    _stallTimer = 0;
+    _portLock = 0;
+    _interruptCount = 0;
+    _stallInterrupts = 0;
+    _stallSuspect = false;
+    _portDraining = false;
+    _stallRecoveries = 0;
+    _pollTicks = 0;
+    _polledBytes = 0;
+    _pollTime = 0;
+    _telemetryMemory = 0;
+    _telemetry = 0;
     
     queue_init(&_requestQueue);
     
@@ -415,6 +529,19 @@ IOReturn ApplePS2Controller::setPropertiesGated(OSObject* props)
         _mouseWakeFirst = flag->isTrue();
         setProperty("MouseWakeFirst", _mouseWakeFirst);
     }
+    // get hybridPolling
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("HybridPolling")))
+    {
+        _hybridPolling = flag->isTrue();
+        setProperty("HybridPolling", _hybridPolling);
+        if (_stallTimer)
+        {
+            if (_hybridPolling)
+                armStallTimer();
+            else
+                _stallTimer->cancelTimeout();
+        }
+    }
     return kIOReturnSuccess;
 }
 
@@ -434,6 +561,18 @@ IOReturn ApplePS2Controller::setProperties(OSObject* props)
 
 void ApplePS2Controller::resetController(void)
 {
+    //
+    // Every step here reads its reply with a timeout, and on machines with
+    // no aux port (or a slow EC emulating one) those timeouts add up to a
+    // good part of the boot.  So replies that are optional get a short
+    // budget, and the mouse steps are skipped once the aux port is known
+    // to be absent.
+    //
+    
+    uint64_t start, now;
+    clock_get_uptime(&start);
+    UInt32 timeouts = _readTimeouts;
+    
     _suppressTimeout = true;
     UInt8 commandByte;
     
@@ -453,16 +592,23 @@ void ApplePS2Controller::resetController(void)
     writeCommandPort(kCP_GetCommandByte);
     commandByte = readDataPort(kDT_Keyboard);
     DEBUG_LOG("%s: initial commandByte = %02x\n", getName(), commandByte);
+    // Find out early whether there is an aux port at all
+    _auxPresent = checkAuxPort();
     // Issue Test Controller to try to reset device
     writeCommandPort(kCP_TestController);
     readDataPort(kDT_Keyboard);
+    _readTimeoutMS = kProbeTimeoutMS;   // (only a few controllers send a second byte)
     readDataPort(kDT_Mouse);
+    _readTimeoutMS = kDataTimeoutMS;
     // Issue Test Keyboard Port to try to reset device
     writeCommandPort(kCP_TestKeyboardPort);
     readDataPort(kDT_Keyboard);
     // Issue Test Mouse Port to try to reset device
-    writeCommandPort(kCP_TestMousePort);
-    readDataPort(kDT_Mouse);
+    if (_auxPresent)
+    {
+        writeCommandPort(kCP_TestMousePort);
+        readDataPort(kDT_Mouse);
+    }
     _suppressTimeout = false;
     
     //
@@ -482,9 +628,14 @@ void ApplePS2Controller::resetController(void)
     writeDataPort(kDP_SetDefaultsAndDisable);
     readDataPort(kDT_Keyboard);       // (discard acknowledge; success irrelevant)
     
-    writeCommandPort(kCP_TransmitToMouse);
-    writeDataPort(kDP_SetDefaultsAndDisable);
-    readDataPort(kDT_Mouse);          // (discard acknowledge; success irrelevant)
+    if (_auxPresent)
+    {
+        writeCommandPort(kCP_TransmitToMouse);
+        writeDataPort(kDP_SetDefaultsAndDisable);
+        _readTimeoutMS = kDeviceTimeoutMS;
+        readDataPort(kDT_Mouse);      // (discard acknowledge; success irrelevant)
+        _readTimeoutMS = kDataTimeoutMS;
+    }
     
     //
     // Clear out garbage in the controller's input streams, before starting up
@@ -497,6 +648,227 @@ void ApplePS2Controller::resetController(void)
         inb(kDataPort);
         IODelay(kDataDelay);
     }
+    
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - start, &now);
+    _resetTime = (UInt32)(now / 1000);
+    setProperty("ResetControllerTime", _resetTime, 32);
+    setProperty("ResetControllerTimeouts", _readTimeouts - timeouts, 32);
+    setProperty("AuxPresent", _auxPresent);
+    if (_telemetry)
+        _telemetry->write(kPS2TS_Controller, kPS2TE_Reset, 0, start, _resetTime, _readTimeouts - timeouts, _auxPresent);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::checkAuxPort(void)
+{
+    //
+    // Same test as Linux i8042_check_aux: a byte written to the aux output
+    // buffer must come back on the mouse input stream.  Some controllers
+    // have a broken loopback, so also check that the disable mouse clock
+    // bit of the command byte sticks, which it only does with an aux port.
+    //
+    // Only called from resetController (no interrupts, no work loop yet).
+    //
+    
+    writeCommandPort(kCP_WriteMouseOutputBuffer);
+    writeDataPort(0x5A);
+    
+    uint64_t now, deadline;
+    clock_interval_to_deadline(kProbeTimeoutMS, kMillisecondScale, &deadline);
+    while (1)
+    {
+        UInt8 status = inb(kCommandPort);
+        if (status & kOutputReady)
+        {
+            IODelay(kDataDelay);
+            UInt8 data = inb(kDataPort);
+            if ((status & kMouseData) && 0x5A == data)
+                return true;
+            break;
+        }
+        clock_get_uptime(&now);
+        if (now >= deadline)
+            break;
+        IODelay(100);
+    }
+    
+    writeCommandPort(kCP_DisableMouseClock);
+    writeCommandPort(kCP_GetCommandByte);
+    UInt8 disabled = readDataPort(kDT_Keyboard);
+    writeCommandPort(kCP_EnableMouseClock);
+    writeCommandPort(kCP_GetCommandByte);
+    UInt8 enabled = readDataPort(kDT_Keyboard);
+    
+    bool present = (disabled & kCB_DisableMouseClock) && !(enabled & kCB_DisableMouseClock);
+    if (!present)
+        IOLog("%s: no aux port found, skipping mouse initialization\n", getName());
+    return present;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::waitForControllerReady(UInt32 maxms)
+{
+    //
+    // After wake, the controller is ready once it answers a command again.
+    // A sane status register (0xFF means nothing is decoding the port yet)
+    // with an empty input buffer is not enough: many ECs show that long
+    // before they process commands.  So once the status looks sane, ask for
+    // the command byte and wait a little for the answer.  Poll with a short
+    // backoff instead of always sleeping for the worst case.
+    //
+    
+    uint64_t now, deadline;
+    clock_interval_to_deadline(maxms, kMillisecondScale, &deadline);
+    UInt32 backoff = 50;    // microseconds
+    
+    while (1)
+    {
+        UInt8 status = inb(kCommandPort);
+        if (0xFF != status && !(status & kInputBusy))
+        {
+            // drop anything left over, so the answer is ours
+            while ((status = inb(kCommandPort)) & kOutputReady)
+            {
+                IODelay(kDataDelay);
+                inb(kDataPort);
+            }
+            outb(kCommandPort, kCP_GetCommandByte);
+            uint64_t replyDeadline;
+            clock_interval_to_deadline(kProbeTimeoutMS, kMillisecondScale, &replyDeadline);
+            if (replyDeadline > deadline)
+                replyDeadline = deadline;
+            do
+            {
+                status = inb(kCommandPort);
+                if ((status & (kOutputReady | kMouseData)) == kOutputReady)
+                {
+                    IODelay(kDataDelay);
+                    inb(kDataPort);
+                    return true;
+                }
+                IODelay(100);
+                clock_get_uptime(&now);
+            } while (now < replyDeadline);
+        }
+        
+        clock_get_uptime(&now);
+        if (now >= deadline)
+            return false;
+        
+        if (backoff < 1000)
+        {
+            IODelay(backoff);
+            backoff <<= 1;
+        }
+        else
+            IOSleep(1);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::waitForMouseReady(UInt32 maxms, bool* sawBAT)
+{
+    //
+    // A device sends its BAT completion code (kSC_Reset) when the power-on
+    // self-test is done.  Not all of them do that on resume though (power
+    // may have been kept), so in between we also probe it with a command that
+    // only returns an acknowledge.  While the self-test is running there is
+    // no acknowledge.
+    //
+    // sawBAT tells the caller which of the two it was.
+    //
+    // This method should only be called from our single-threaded work loop.
+    //
+    
+    *sawBAT = false;
+    if (!maxms)
+        return true;
+    
+    uint64_t now, deadline;
+    clock_interval_to_deadline(maxms, kMillisecondScale, &deadline);
+    UInt32 backoff = 1;     // milliseconds
+    
+    while (1)
+    {
+        //
+        // Look at anything that arrived, a BAT may already be waiting.
+        //
+        
+        UInt8 status;
+        while ((status = inb(kCommandPort)) & kOutputReady)
+        {
+            IODelay(kDataDelay);
+            UInt8 data = inb(kDataPort);
+            if (!(status & kMouseData))
+            {
+                dispatchDriverInterrupt(kDT_Keyboard, data);
+                continue;
+            }
+            if (kSC_Reset == data)
+            {
+                // BAT is followed by the device ID
+                IODelay(kDataDelay);
+                readDataPort(kDT_Mouse);
+                *sawBAT = true;
+                return true;
+            }
+        }
+        
+        //
+        // Probe it, but only wait a few milliseconds for the answer.
+        //
+        
+        writeCommandPort(kCP_TransmitToMouse);
+        writeDataPort(kDP_SetDefaultsAndDisable);
+        bool probed = false;
+        uint64_t probeDeadline;
+        clock_interval_to_deadline(backoff + 2, kMillisecondScale, &probeDeadline);
+        while (!probed)
+        {
+            status = inb(kCommandPort);
+            if ((status & (kOutputReady | kMouseData)) == (kOutputReady | kMouseData))
+            {
+                IODelay(kDataDelay);
+                UInt8 data = inb(kDataPort);
+                if (kSC_Acknowledge == data)
+                    return true;
+                if (kSC_Reset == data)
+                {
+                    IODelay(kDataDelay);
+                    readDataPort(kDT_Mouse);
+                    *sawBAT = true;
+                    return true;
+                }
+                // resend/error while still in self-test
+                probed = true;
+            }
+            else if (status & kOutputReady)
+            {
+                IODelay(kDataDelay);
+                dispatchDriverInterrupt(kDT_Keyboard, inb(kDataPort));
+            }
+            else
+            {
+                clock_get_uptime(&now);
+                if (now >= probeDeadline)
+                    probed = true;
+                else
+                    IODelay(100);
+            }
+        }
+        
+        clock_get_uptime(&now);
+        if (now >= deadline)
+            return false;
+        
+        IOSleep(backoff);
+        if (backoff < 32)
+            backoff <<= 1;
+    }
 }
 
 // -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -540,6 +912,20 @@ bool ApplePS2Controller::start(IOService * provider)
     }
 #endif
     
+    //
+    // Telemetry ring for user space monitors (see ApplePS2TelemetryClient).
+    // Not having it is not fatal.
+    //
+    
+    _telemetryMemory = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, kIODirectionInOut | kIOMemoryKernelUserShared, round_page(sizeof(PS2TelemetryRing)), page_size);
+    if (_telemetryMemory)
+    {
+        mach_timebase_info_data_t timebase;
+        clock_timebase_info(&timebase);
+        _telemetry = (PS2TelemetryRing*)_telemetryMemory->getBytesNoCopy();
+        _telemetry->init(timebase.numer, timebase.denom);
+    }
+    
     //
     // Reset and clean the 8042 keyboard/mouse controller.
     //
@@ -554,6 +940,8 @@ bool ApplePS2Controller::start(IOService * provider)
     if (!_requestQueueLock) goto fail;
     _cmdbyteLock = IOLockAlloc();
     if (!_cmdbyteLock) goto fail;
+    _portLock = IOSimpleLockAlloc();
+    if (!_portLock) goto fail;
     
     //
     // Initialize our work loop, our command gate, and our interrupt event
@@ -575,6 +963,7 @@ bool ApplePS2Controller::start(IOService * provider)
     _interruptSourceQueue    = IOInterruptEventSource::interruptEventSource( this,
                                                                             OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::processRequestQueue));
     _cmdGate = IOCommandGate::commandGate(this);
+    _stallTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onStallTimer));
 #if WATCHDOG_TIMER
     _watchdogTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onWatchdogTimer));
     if (!_watchdogTimer)
@@ -585,12 +974,16 @@ bool ApplePS2Controller::start(IOService * provider)
         !_interruptSourceMouse    ||
         !_interruptSourceKeyboard ||
         !_interruptSourceQueue    ||
-        !_cmdGate)  goto fail;
+        !_cmdGate                 ||
+        !_stallTimer)  goto fail;
     
     if ( _workLoop->addEventSource(_interruptSourceQueue) != kIOReturnSuccess )
         goto fail;
     if ( _workLoop->addEventSource(_cmdGate) != kIOReturnSuccess )
         goto fail;
+    if ( _workLoop->addEventSource(_stallTimer) != kIOReturnSuccess )
+        goto fail;
+    armStallTimer();
     
 #if WATCHDOG_TIMER
     if ( _workLoop->addEventSource(_watchdogTimer) != kIOReturnSuccess )
@@ -693,9 +1086,19 @@ void ApplePS2Controller::stop(IOService * provider)
     OSSafeReleaseNULL(_interruptSourceMouse);
     OSSafeReleaseNULL(_interruptSourceQueue);
     OSSafeReleaseNULL(_cmdGate);
+    if (_stallTimer)
+    {
+        _stallTimer->cancelTimeout();
+        if (_workLoop)
+            _workLoop->removeEventSource(_stallTimer);
+        _stallTimer->release();
+        _stallTimer = 0;
+    }
 #if WATCHDOG_TIMER
     OSSafeReleaseNULL(_watchdogTimer);
 #endif
+    _telemetry = 0;
+    OSSafeReleaseNULL(_telemetryMemory);
     
     // Free the work loop.
     OSSafeReleaseNULL(_workLoop);
@@ -713,6 +1116,11 @@ void ApplePS2Controller::stop(IOService * provider)
         IOLockFree(_cmdbyteLock);
         _cmdbyteLock = 0;
     }
+    if (_portLock)
+    {
+        IOSimpleLockFree(_portLock);
+        _portLock = 0;
+    }
     
     // Free the power management thread call.
     if (_powerChangeThreadCall)
@@ -745,6 +1153,71 @@ IOWorkLoop * ApplePS2Controller::getWorkLoop() const
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+IOMemoryDescriptor* ApplePS2Controller::copyTelemetryMemory()
+{
+    if (_telemetryMemory)
+        _telemetryMemory->retain();
+    return _telemetryMemory;
+}
+
+void ApplePS2Controller::attachTelemetryReader(bool attach)
+{
+    if (!_telemetry)
+        return;
+    if (attach)
+        OSIncrementAtomic((volatile SInt32*)&_telemetry->readers);
+    else
+        OSDecrementAtomic((volatile SInt32*)&_telemetry->readers);
+}
+
+// =============================================================================
+// ApplePS2TelemetryClient Class Implementation
+//
+
+OSDefineMetaClassAndStructors(ApplePS2TelemetryClient, IOUserClient);
+
+bool ApplePS2TelemetryClient::initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties)
+{
+    if (kIOReturnSuccess != clientHasPrivilege(securityToken, kIOClientPrivilegeAdministrator))
+        return false;
+    return super::initWithTask(owningTask, securityToken, type, properties);
+}
+
+bool ApplePS2TelemetryClient::start(IOService* provider)
+{
+    _owner = OSDynamicCast(ApplePS2Controller, provider);
+    if (!_owner || !_owner->getTelemetry() || !super::start(provider))
+        return false;
+    _owner->attachTelemetryReader(true);
+    return true;
+}
+
+void ApplePS2TelemetryClient::stop(IOService* provider)
+{
+    _owner->attachTelemetryReader(false);
+    super::stop(provider);
+}
+
+IOReturn ApplePS2TelemetryClient::clientClose(void)
+{
+    if (!isInactive())
+        terminate();
+    return kIOReturnSuccess;
+}
+
+IOReturn ApplePS2TelemetryClient::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory)
+{
+    if (kPS2TelemetryMemoryType != type)
+        return kIOReturnBadArgument;
+    *memory = _owner->copyTelemetryMemory();
+    if (!*memory)
+        return kIOReturnNoMemory;
+    *options = kIOMapReadOnly;
+    return kIOReturnSuccess;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::installInterruptAction(PS2DeviceType      deviceType,
                                                 OSObject *         target,
                                                 PS2InterruptAction interruptAction,
@@ -1029,6 +1502,7 @@ void ApplePS2Controller::packetReadyKeyboard(IOInterruptEventSource *, int)
     // -- dispatch it to the installed keyboard packet handler
     if (_interruptInstalledKeyboard)
         (*_packetActionKeyboard)(_interruptTargetKeyboard);
+    armStallTimer();
 }
 
 void ApplePS2Controller::packetReadyMouse(IOInterruptEventSource *, int)
@@ -1037,6 +1511,7 @@ void ApplePS2Controller::packetReadyMouse(IOInterruptEventSource *, int)
     // -- dispatch it to the installed mouse packet handler
     if (_interruptInstalledMouse)
         (*_packetActionMouse)(_interruptTargetMouse);
+    armStallTimer();
 }
 #endif // !HANDLE_INTERRUPT_DATA_LATER
 
@@ -1106,6 +1581,7 @@ void ApplePS2Controller::processRequest(PS2Request * request)
     // data by polling for it here.
     
     ++_ignoreInterrupts;
+    _readTimeoutMS = kDataTimeoutMS;
     
     // Process each of the commands in the list.
     
@@ -1198,12 +1674,73 @@ void ApplePS2Controller::processRequest(PS2Request * request)
                 break;
                 
             case kPS2C_ModifyCommandByte:
+            {
                 writeCommandPort(kCP_GetCommandByte);
                 UInt8 commandByte = readDataPort(kDT_Keyboard);
                 writeCommandPort(kCP_SetCommandByte);
                 writeDataPort((commandByte | request->commands[index].setBits) & ~request->commands[index].clearBits);
                 request->commands[index].oldBits = commandByte;
                 break;
+            }
+                
+            case kPS2C_WaitMouseReady:
+            {
+                uint64_t start, end;
+                clock_get_uptime(&start);
+                bool sawBAT;
+                deviceMode = kDT_Mouse;
+                failed = !waitForMouseReady(request->commands[index].inOrOut32, &sawBAT);
+                clock_get_uptime(&end);
+                absolutetime_to_nanoseconds(end - start, &end);
+                request->commands[index].inOrOut32 = ((UInt32)(end / 1000) & ~kPS2C_MouseReadyBAT) | (sawBAT ? kPS2C_MouseReadyBAT : 0);
+                break;
+            }
+                
+            case kPS2C_SetReadTimeout:
+                _readTimeoutMS = request->commands[index].inOrOut32 ? request->commands[index].inOrOut32 : kDataTimeoutMS;
+                break;
+                
+            case kPS2C_SendMouseCommandsAndCompareAck:
+            {
+                PS2Command& cmd = request->commands[index];
+                deviceMode = kDT_Mouse;
+                unsigned count;
+                for (count = 0; count < cmd.count; count++)
+                {
+                    writeCommandPort(kCP_TransmitToMouse);
+                    writeDataPort(cmd.buffer[count]);
+#if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
+                    byte = readDataPort(kDT_Mouse, kSC_Acknowledge);
+#else
+                    byte = readDataPort(kDT_Mouse);
+#endif
+                    if (byte != kSC_Acknowledge)
+                    {
+                        failed = true;
+                        break;
+                    }
+                }
+                cmd.count = count;
+                break;
+            }
+                
+            case kPS2C_ReadMouseDataPortBytes:
+            {
+                PS2Command& cmd = request->commands[index];
+                deviceMode = kDT_Mouse;
+                unsigned count;
+                for (count = 0; count < cmd.count; count++)
+                {
+                    cmd.buffer[count] = readDataPort(kDT_Mouse);
+                    if (_readTimedOut)
+                    {
+                        failed = true;
+                        break;
+                    }
+                }
+                cmd.count = count;
+                break;
+            }
         }
         
         if (failed) break;
@@ -1211,6 +1748,7 @@ void ApplePS2Controller::processRequest(PS2Request * request)
     
     // Now it is ok to process interrupts normally.
     
+    _readTimeoutMS = kDataTimeoutMS;
     --_ignoreInterrupts;
     
 hardware_offline:
@@ -1273,15 +1811,16 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
     // driver interrupt routine immediately (effectively, the request is
     // "preempted" temporarily).
     //
-    // There is a built-in timeout for this command of (timeoutCounter X
-    // kDataDelay) microseconds, approximately.
+    // There is a built-in timeout for this command of _readTimeoutMS
+    // milliseconds, approximately (counted in kDataDelay steps).
     //
     // This method should only be called from our single-threaded work loop.
     //
     
     UInt8  readByte;
     UInt8  status;
-    UInt32 timeoutCounter = 10000;    // (timeoutCounter * kDataDelay = 70 ms)
+    UInt32 timeoutCounter = _readTimeoutMS * 1000 / kDataDelay;
+    _readTimedOut = false;
     
     while (1)
     {
@@ -1315,6 +1854,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
             unlockController(state);  // (release interrupt lockout + access to queue)
 #endif //DEBUGGER_SUPPORT
             
+            _readTimedOut = true;
+            ++_readTimeouts;
             if (!_suppressTimeout)
                 IOLog("%s: Timed out on %s input stream.\n", getName(),
                       (deviceType == kDT_Keyboard) ? "keyboard" : "mouse");
@@ -1376,8 +1917,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
     // driver interrupt routine immediately (effectively, the request is
     // "preempted" temporarily).
     //
-    // There is a built-in timeout for this command of (timeoutCounter X
-    // kDataDelay) microseconds, approximately.
+    // There is a built-in timeout for this command of _readTimeoutMS
+    // milliseconds, approximately (counted in kDataDelay steps).
     //
     // This method should only be called from our single-threaded work loop.
     //
@@ -1403,7 +1944,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
     UInt8  readByte;
     bool   requestedStream;
     UInt8  status;
-    UInt32 timeoutCounter = 10000;    // (timeoutCounter * kDataDelay = 70 ms)
+    UInt32 timeoutCounter = _readTimeoutMS * 1000 / kDataDelay;
+    _readTimedOut = false;
     
     while (1)
     {
@@ -1441,6 +1983,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
             
             if (firstByteHeld)  return firstByte;
             
+            _readTimedOut = true;
+            ++_readTimeouts;
             IOLog("%s: Timed out on %s input stream.\n", getName(),
                   (deviceType == kDT_Keyboard) ? "keyboard" : "mouse");
             return 0;
@@ -1832,6 +2376,9 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
         switch ( powerState )
         {
             case kPS2PowerStateSleep:
+            {
+                uint64_t start, now;
+                clock_get_uptime(&start);
                 
                 //
                 // 1. Make sure clocks are enabled, but IRQ lines held low.
@@ -1843,7 +2390,8 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
                 
                 // 2. Notify clients about the state change. Clients can issue
                 //    synchronous requests thanks to the recursive lock.
-                //    First Mouse, then Keyboard.
+                //    First Mouse, then Keyboard.  Each client publishes its
+                //    own SuspendTime.
                 
                 dispatchDriverPowerControl( kPS2C_DisableDevice, kDT_Mouse );
                 dispatchDriverPowerControl( kPS2C_DisableDevice, kDT_Keyboard );
@@ -1853,6 +2401,10 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
                 
                 _hardwareOffline = true;
                 
+                clock_get_uptime(&now);
+                absolutetime_to_nanoseconds(now - start, &now);
+                setProperty("SuspendTime", (UInt32)(now / 1000), 32);
+                
                 // 4. Disable the PS/2 port.
                 
 #if DISABLE_CLOCKS_IRQS_BEFORE_SLEEP
@@ -1864,6 +2416,7 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
                 setCommandByte(kCB_DisableKeyboardClock | kCB_DisableMouseClock, 0);
 #endif // DISABLE_CLOCKS_IRQS_BEFORE_SLEEP
                 break;
+            }
                 
             case kPS2PowerStateDoze:
             case kPS2PowerStateNormal:
@@ -1875,8 +2428,23 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
                     break;
                 }
                 
+            {
+                uint64_t start, now;
+                clock_get_uptime(&start);
+                
+                //
+                // WakeDelay is only the upper bound now.  Continue as soon as
+                // the controller is responding again.
+                //
+                
                 if (_wakedelay)
-                    IOSleep(_wakedelay);
+                    waitForControllerReady(_wakedelay);
+                
+                clock_get_uptime(&now);
+                absolutetime_to_nanoseconds(now - start, &now);
+                _wakeReadyTime = (UInt32)(now / 1000);
+                if (_wakeReadyTime > _wakeReadyTimeMax)
+                    _wakeReadyTimeMax = _wakeReadyTime;
                 
 #if FULL_INIT_AFTER_WAKE
                 //
@@ -1922,7 +2490,16 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
                 DEBUG_LOG("%s: setCommandByte for wake 2\n", getName());
                 setCommandByte(kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ | kCB_SystemFlag, 0);
                 --_ignoreInterrupts;
+                
+                // resume latency telemetry
+                clock_get_uptime(&now);
+                absolutetime_to_nanoseconds(now - start, &now);
+                _resumeTime = (UInt32)(now / 1000);
+                setProperty("WakeReadyTime", _wakeReadyTime, 32);
+                setProperty("WakeReadyTimeMax", _wakeReadyTimeMax, 32);
+                setProperty("ResumeTime", _resumeTime, 32);
                 break;
+            }
                 
             default:
                 IOLog("%s: bad power state %ld\n", getName(), (long)powerState);
@@ -26,10 +26,13 @@
 #include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOUserClient.h>
 #include "ApplePS2Device.h"
 
 class ApplePS2KeyboardDevice;
 class ApplePS2MouseDevice;
+class IOTimerEventSource;
+class IOBufferMemoryDescriptor;
 
 //
 // This section describes the problem with the PS/2 controller design and what
@@ -126,6 +129,9 @@ class ApplePS2MouseDevice;
 // Port timings.
 
 #define kDataDelay              7       // usec to delay before data is valid
+#define kDataTimeoutMS          70      // default readDataPort budget
+#define kProbeTimeoutMS         10      // budget for replies that may never come
+#define kDeviceTimeoutMS        25      // devices must answer commands within 20ms
 
 // Ports used to control the PS/2 keyboard/mouse and read data from it.
 
@@ -145,6 +151,11 @@ class ApplePS2MouseDevice;
 
 #define kWatchdogTimerInterval  100
 
+// Hybrid polling intervals (see onStallTimer)
+
+#define kStallCheckMS           50      // after the last packet
+#define kStallPollMS            2       // right after a stall, or suspecting one
+
 #if DEBUGGER_SUPPORT
 // Definitions for our internal keyboard queue (holds keys processed by the
 // interrupt-time mini-monitor-key-sequence detection code).
@@ -243,15 +254,36 @@ private:
     UInt32                   _currentPowerState;
     bool                     _hardwareOffline;
     bool   				   _suppressTimeout;
+    UInt32                   _readTimeoutMS;        // readDataPort budget
+    bool                     _readTimedOut;         // last readDataPort timed out
+    UInt32                   _readTimeouts;
+    bool                     _auxPresent;
+    UInt32                   _resetTime;            // last resetController (us)
 #ifdef NEWIRQ
     bool   				   _newIRQLayout;
 #endif
     int                      _wakedelay;
     bool                     _mouseWakeFirst;
+    UInt32                   _wakeReadyTime;        // last resume: controller ready (us)
+    UInt32                   _wakeReadyTimeMax;
+    UInt32                   _resumeTime;           // last resume: total (us)
     IOCommandGate*           _cmdGate;
 #if WATCHDOG_TIMER
     IOTimerEventSource*      _watchdogTimer;
 #endif
+    bool                     _hybridPolling;
+    IOTimerEventSource*      _stallTimer;
+    IOSimpleLock*            _portLock;             // port drain: interrupts vs. stall timer
+    bool                     _portDraining;         // under _portLock, see handleInterrupt
+    volatile SInt32          _interruptCount;       // IRQ1 + IRQ12
+    SInt32                   _stallInterrupts;      // _interruptCount at last tick
+    bool                     _stallSuspect;
+    UInt32                   _stallRecoveries;
+    UInt32                   _pollTicks;
+    UInt32                   _polledBytes;
+    uint64_t                 _pollTime;             // abs
+    IOBufferMemoryDescriptor* _telemetryMemory;
+    PS2TelemetryRing*        _telemetry;
     
     virtual PS2InterruptResult _dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
     virtual void dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
@@ -261,10 +293,12 @@ private:
     void packetReadyMouse(IOInterruptEventSource*, int);
     void packetReadyKeyboard(IOInterruptEventSource*, int);
 #endif
-    void handleInterrupt(PS2DeviceType deviceType);
+    UInt32 handleInterrupt(PS2DeviceType deviceType);
 #if WATCHDOG_TIMER
     void onWatchdogTimer();
 #endif
+    void onStallTimer();
+    void armStallTimer();
     virtual void  processRequest(PS2Request * request);
     virtual void  processRequestQueue(IOInterruptEventSource *, int);
     
@@ -272,6 +306,9 @@ private:
     virtual void  writeCommandPort(UInt8 byte);
     virtual void  writeDataPort(UInt8 byte);
     void resetController(void);
+    bool checkAuxPort(void);
+    bool waitForControllerReady(UInt32 maxms);
+    bool waitForMouseReady(UInt32 maxms, bool* sawBAT);
     
     static void interruptHandlerMouse(OSObject*, void* refCon, IOService*, int);
     static void interruptHandlerKeyboard(OSObject*, void* refCon, IOService*, int);
@@ -338,6 +375,34 @@ public:
     
     static OSDictionary* getConfigurationNode(OSDictionary* list, OSString* model = 0);
     static OSDictionary* makeConfigurationNode(OSDictionary* list, OSString* model = 0);
+    
+    inline PS2TelemetryRing* getTelemetry() const { return _telemetry; }
+    IOMemoryDescriptor* copyTelemetryMemory();
+    void attachTelemetryReader(bool attach);
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ApplePS2TelemetryClient Class Declaration
+//
+// Maps the telemetry ring (see PS2Telemetry.h) read only into the client.
+// Writers are enabled for as long as at least one client is open.  Only
+// administrators may open it, since the ring shows input timing.
+//
+
+class EXPORT ApplePS2TelemetryClient : public IOUserClient
+{
+    typedef IOUserClient super;
+    OSDeclareDefaultStructors(ApplePS2TelemetryClient);
+    
+private:
+    ApplePS2Controller* _owner;
+    
+public:
+    virtual bool initWithTask(task_t owningTask, void* securityToken, UInt32 type, OSDictionary* properties);
+    virtual bool start(IOService* provider);
+    virtual void stop(IOService* provider);
+    virtual IOReturn clientClose(void);
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory);
 };
 
 #endif /* _APPLEPS2CONTROLLER_H */
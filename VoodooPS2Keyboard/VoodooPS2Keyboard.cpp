@@ -68,6 +68,8 @@
 #define kActionSwipeLeft                    "ActionSwipeLeft"
 #define kActionSwipeRight                   "ActionSwipeRight"
 #define kBrightnessHack                     "BrightnessHack"
+#define kFastSuspend                        "FastSuspend"
+#define kEventLog                           "EventLog"
 #define kMacroInversion                     "Macro Inversion"
 #define kMacroTranslation                   "Macro Translation"
 #define kMaxMacroTime                       "MaximumMacroTime"
@@ -83,10 +85,49 @@
 #define kSequenceBytesOffset    (kPrefixBytes+0)
 #define kMinMacroInversion      (kPrefixBytes+2)
 
+#define kHotkeys                            "Hotkeys"
+
+// hotkey actions, in the order of the kHotkey enum
+static const char* const hotkeyActionNames[] =
+{
+    "pass",
+    "eat",
+    "backlight",
+    "brightness",
+    "power",
+    "sleep",
+    "touchpad",
+    "fnkeys",
+};
+
+// built-in hotkeys, matched after the ones from the profile (see parseHotkey)
+static const char* const defaultHotkeys[] =
+{
+    "4e 11 11=backlight",   // Ctrl+Alt+Numpad+ (if ACPI keyboard backlight)
+    "4a 11 11=backlight",   // Ctrl+Alt+Numpad-
+    "4e 5 5=brightness",    // Ctrl+Shift+Numpad+ (if BrightnessHack)
+    "4a 5 5=brightness",    // Ctrl+Shift+Numpad-
+    "e053 11 11=power",     // Ctrl+Alt+Delete
+    "e05f=sleep",
+    "e028 1 0=touchpad",    // discrete trackpad toggle, but not with Ctrl
+    "e028 1 1=eat",
+    "e037 1 0=touchpad",    // PrtSc toggles the trackpad...
+    "e037 1 1=fnkeys",      // ...and Ctrl+PrtSc the fn keys
+    "e027=fnkeys",          // discrete fnkeys toggle
+};
+
 // Constants for other services to communicate with
 
 #define kIOHIDSystem                        "IOHIDSystem"
 
+// hot path log sites, in the order of the kLog enum
+static const PS2EventLogSite logSites[] =
+{
+    { "unexpected reset (%02x %02x) from PS/2 controller", 4 },
+    { "unexpected acknowledge (%02x) from PS/2 controller", 4 },
+    { "unexpected resend (%02x) request from PS/2 controller", 4 },
+};
+
 // =============================================================================
 // ApplePS2Keyboard Class Implementation
 //
@@ -154,6 +195,44 @@ static bool parseRemap(const char *psz, UInt16 &scanFrom, UInt16& scanTo)
     return true;
 }
 
+static bool parseHotkey(const char* psz, UInt16& scan, UInt16& mask, UInt16& compare, int& action)
+{
+    // psz is of the form: "scan[ mask compare]=action", numbers in hex, examples:
+    //      any modifiers:      "e05f=sleep"
+    //      Ctrl+Alt+Delete:    "e053 11 11=power"
+    //      PrtSc without Ctrl: "e037 1 0=touchpad"
+    // mask and compare are _PS2modifierState bits (kMaskLeftControl...),
+    // compare ffff means any of the bits in mask
+    
+    unsigned n;
+    psz = parseHex(psz, ' ', '=', n);
+    if (NULL == psz || n > 0xFFFF)
+        return false;
+    scan = n;
+    mask = compare = 0;
+    if (' ' == *psz)
+    {
+        psz = parseHex(psz+1, ' ', 0, n);
+        if (NULL == psz || ' ' != *psz || n > 0xFFFF)
+            return false;
+        mask = n;
+        psz = parseHex(psz+1, '=', 0, n);
+        if (NULL == psz || n > 0xFFFF)
+            return false;
+        compare = n;
+    }
+    if ('=' != *psz)
+        return false;
+    ++psz;
+    for (action = 0; action < countof(hotkeyActionNames); action++)
+    {
+        size_t length = strlen(hotkeyActionNames[action]);
+        if (0 == strncmp(psz, hotkeyActionNames[action], length) && (0 == psz[length] || ';' == psz[length]))
+            return true;
+    }
+    return false;
+}
+
 static bool parseAction(const char* psz, UInt16 dest[], int size)
 {
     int i = 0;
@@ -250,7 +329,13 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     _backlightLevels = 0;
     
     _logscancodes = 0;
+    _eventLog.init(logSites, countof(logSites));
+    _telemetry = 0;
     _brightnessHack = false;
+    _hotkeys = 0;
+    bzero(_hotkeyStart, sizeof(_hotkeyStart));
+    _fastsuspend = true;
+    _suspendedFast = false;
     
     // initalize macro translation
     _macroInversion = 0;
@@ -334,6 +419,9 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
         }
     }
     
+    // hotkeys from the profile, then the built-in ones
+    compileHotkeys(config ? OSDynamicCast(OSArray, config->getObject(kHotkeys)) : NULL);
+    
     // now copy to our PS2ToADBMap -- working copy...
     bcopy(_PS2ToADBMapMapped, _PS2ToADBMap, sizeof(_PS2ToADBMap));
     
@@ -377,6 +465,11 @@ void ApplePS2Keyboard::free()
         delete[] _macroBuffer;
         _macroBuffer = 0;
     }
+    if (_hotkeys)
+    {
+        delete[] _hotkeys;
+        _hotkeys = 0;
+    }
     
     super::free();
 }
@@ -451,6 +544,7 @@ bool ApplePS2Keyboard::start(IOService * provider)
     
     _device = (ApplePS2KeyboardDevice *)provider;
     _device->retain();
+    _telemetry = _device->getTelemetry();
     
     //
     // Setup workloop with command gate for thread syncronization...
@@ -755,6 +849,185 @@ void ApplePS2Keyboard::loadCustomADBMap(OSDictionary* dict, const char* name)
     }
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Keyboard::compileHotkeys(OSArray* pArray)
+{
+    //
+    // Hotkeys are kept grouped by key code, so a key press only looks at the
+    // entries for its own key (none for most keys).  Within a key they are
+    // in the order given, profile entries first, and the first one whose
+    // modifiers match and whose action applies wins.
+    //
+    
+    int profileCount = pArray ? pArray->getCount() : 0;
+    int total = profileCount + countof(defaultHotkeys);
+    UInt16* keys = new UInt16[total];
+    HotkeyEntry* entries = new HotkeyEntry[total];
+    int count = 0;
+    for (int i = 0; i < total; i++)
+    {
+        const char* psz;
+        if (i < profileCount)
+        {
+            OSString* pString = OSDynamicCast(OSString, pArray->getObject(i));
+            if (NULL == pString)
+                continue;
+            psz = pString->getCStringNoCopy();
+            // check for comment
+            if (';' == *psz)
+                continue;
+        }
+        else
+            psz = defaultHotkeys[i-profileCount];
+        // otherwise, try to parse it
+        UInt16 scan, mask, compare;
+        int action;
+        if (!parseHotkey(psz, scan, mask, compare, action))
+        {
+            IOLog("VoodooPS2Keyboard: invalid hotkey entry: \"%s\"\n", psz);
+            continue;
+        }
+        // must be normal scan code or extended, nothing else
+        UInt8 ex = scan >> 8;
+        if (ex != 0 && ex != 0xe0)
+        {
+            IOLog("VoodooPS2Keyboard: scan code invalid for hotkey entry: \"%s\"\n", psz);
+            continue;
+        }
+        keys[count] = (scan & 0xff) + (ex == 0xe0 ? KBV_NUM_SCANCODES : 0);
+        entries[count].mask = mask;
+        entries[count].compare = compare;
+        entries[count].action = action;
+        ++count;
+    }
+    
+    // lay them out by key code, keeping the order within each key
+    if (_hotkeys)
+        delete[] _hotkeys;
+    _hotkeys = new HotkeyEntry[count ? count : 1];
+    int n = 0;
+    for (int key = 0; key < KBV_NUM_SCANCODES*2; key++)
+    {
+        _hotkeyStart[key] = n;
+        for (int i = 0; i < count; i++)
+            if (keys[i] == key)
+                _hotkeys[n++] = entries[i];
+    }
+    _hotkeyStart[KBV_NUM_SCANCODES*2] = n;
+    delete[] keys;
+    delete[] entries;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Keyboard::runHotkey(int action, unsigned& keyCode, bool goingDown, uint64_t now_abs)
+{
+    // returns false if the action does not apply, so the next entry is tried;
+    // otherwise keyCode is set to 0 if the key is eaten
+    
+    switch (action)
+    {
+        case kHotkeyPass:
+            return true;
+            
+        case kHotkeyEat:
+            break;
+            
+        case kHotkeyBacklight:
+            if (!_backlightLevels)
+                return false;
+            // Ctrl+Alt+Numpad(+/-) => use to manipulate keyboard backlight
+            modifyKeyboardBacklight(keyCode, goingDown);
+            break;
+            
+        case kHotkeyBrightness:
+        {
+            if (!_brightnessHack)
+                return false;
+            // Ctrl+Shift+NumPad(+/0) => manipulate brightness (special hack for HP Envy)
+            // Fn+F2 generates e0 ab and so does Fn+F3 (we will null those out in ps2 map)
+            static unsigned keys[] = { 0x2a, 0x1d };
+            // if Option key is down don't pull up on the Shift keys
+            int start = checkModifierState(kMaskLeftWindows) ? 1 : 0;
+            for (int i = start; i < countof(keys); i++)
+                if (KBV_IS_KEYDOWN(keys[i]))
+                    dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], false, now_abs);
+            dispatchKeyboardEventX(keyCode == 0x4e ? 0x90 : 0x91, goingDown, now_abs);
+            for (int i = start; i < countof(keys); i++)
+                if (KBV_IS_KEYDOWN(keys[i]))
+                    dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], true, now_abs);
+            break;
+        }
+            
+        case kHotkeyPower:
+            // Ctrl+Alt+Delete (three finger salute)
+            if (!goingDown)
+            {
+                // Note: If OS X thinks the Command and Control keys are down at the time of
+                //  receiving an ADB 0x7f (power button), it will unconditionaly and unsafely
+                //  reboot the computer, much like the old PC/AT Ctrl+Alt+Delete!
+                // That's why we make sure Control (0x3b) and Alt (0x37) are up!!
+                dispatchKeyboardEventX(0x37, false, now_abs);
+                dispatchKeyboardEventX(0x3b, false, now_abs);
+                dispatchKeyboardEventX(0x7f, true, now_abs);
+                dispatchKeyboardEventX(0x7f, false, now_abs);
+            }
+            break;
+            
+        case kHotkeySleep:
+            if (goingDown)
+            {
+                _timerFunc = kTimerSleep;
+                if (_fkeymode || !_maxsleeppresstime)
+                    onSleepEjectTimer();
+                else
+                    setTimerTimeout(_sleepEjectTimer, (uint64_t)_maxsleeppresstime * 1000000);
+            }
+            else
+            {
+                cancelTimer(_sleepEjectTimer);
+            }
+            break;
+            
+        case kHotkeyTouchpad:
+            if (goingDown)
+            {
+                // get current enabled status, and toggle it
+                bool enabled;
+                _device->dispatchMouseMessage(kPS2M_getDisableTouchpad, &enabled);
+                enabled = !enabled;
+                _device->dispatchMouseMessage(kPS2M_setDisableTouchpad, &enabled);
+            }
+            break;
+            
+        case kHotkeyFnKeys:
+            if (goingDown && _fkeymodesupported)
+            {
+                // modify HIDFKeyMode via IOService... IOHIDSystem
+                if (IOService* service = IOService::waitForMatchingService(serviceMatching(kIOHIDSystem), 0))
+                {
+                    const OSObject* num = OSNumber::withNumber(!_fkeymode, 32);
+                    const OSString* key = OSString::withCString(kHIDFKeyMode);
+                    if (num && key)
+                    {
+                        if (OSDictionary* dict = OSDictionary::withObjects(&num, &key, 1))
+                        {
+                            service->setProperties(dict);
+                            dict->release();
+                        }
+                    }
+                    OSSafeReleaseNULL(num);
+                    OSSafeReleaseNULL(key);
+                    service->release();
+                }
+            }
+            break;
+    }
+    keyCode = 0;
+    return true;
+}
+
 OSData** ApplePS2Keyboard::loadMacroData(OSDictionary* dict, const char* name)
 {
     OSData** result = 0;
@@ -892,6 +1165,18 @@ void ApplePS2Keyboard::setParamPropertiesGated(OSDictionary * dict)
         _brightnessHack = true;
     }
     
+    // format the hot path event log into the registry (EventLog, EventLogCounts)
+    if (dict->getObject(kEventLog))
+        _eventLog.publish(this);
+    
+    // disable only (no reset on wake) when going to sleep
+    xml = OSDynamicCast(OSBoolean, dict->getObject(kFastSuspend));
+    if (xml)
+    {
+        _fastsuspend = xml->isTrue();
+        setProperty(kFastSuspend, _fastsuspend ? kOSBooleanTrue : kOSBooleanFalse);
+    }
+    
     // these two options are mutually exclusive
     // kMakeApplicationKeyAppleFN is ignored if kMakeApplicationKeyRightWindows is set
     bool temp = false;
@@ -1180,7 +1465,7 @@ PS2InterruptResult ApplePS2Keyboard::interruptOccurred(UInt8 data)   // PS2Inter
     // special case for $AA $00, spontaneous reset (usually due to static electricity)
     if (kSC_Reset == _lastdata && 0x00 == data)
     {
-        IOLog("%s: Unexpected reset (%02x %02x) request from PS/2 controller.\n", getName(), _lastdata, data);
+        _eventLog.log(kLogUnexpectedReset, _lastdata, data);
         
         // buffer a packet that will cause a reset in work loop
         packet[0] = 0x00;
@@ -1196,12 +1481,12 @@ PS2InterruptResult ApplePS2Keyboard::interruptOccurred(UInt8 data)   // PS2Inter
     // other data error conditions
     if (kSC_Acknowledge == data)
     {
-        IOLog("%s: Unexpected acknowledge (%02x) from PS/2 controller.\n", getName(), data);
+        _eventLog.log(kLogUnexpectedAck, data);
         return kPS2IR_packetBuffering;
     }
     if (kSC_Resend == data)
     {
-        IOLog("%s: Unexpected resend (%02x) request from PS/2 controller.\n", getName(), data);
+        _eventLog.log(kLogUnexpectedResend, data);
         return kPS2IR_packetBuffering;
     }
     
@@ -1656,115 +1941,13 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
         }
     }
     
-    // handle special cases
-    switch (keyCode)
+    // handle hotkeys (see compileHotkeys)
+    for (int i = _hotkeyStart[keyCode], end = _hotkeyStart[keyCode+1]; i < end; i++)
     {
-        case 0x4e:  // Numpad+
-        case 0x4a:  // Numpad-
-            if (_backlightLevels && checkModifierState(kMaskLeftControl|kMaskLeftAlt))
-            {
-                // Ctrl+Alt+Numpad(+/-) => use to manipulate keyboard backlight
-                modifyKeyboardBacklight(keyCode, goingDown);
-                keyCode = 0;
-            }
-            else if (_brightnessHack && checkModifierState(kMaskLeftControl|kMaskLeftShift))
-            {
-                // Ctrl+Shift+NumPad(+/0) => manipulate brightness (special hack for HP Envy)
-                // Fn+F2 generates e0 ab and so does Fn+F3 (we will null those out in ps2 map)
-                static unsigned keys[] = { 0x2a, 0x1d };
-                // if Option key is down don't pull up on the Shift keys
-                int start = checkModifierState(kMaskLeftWindows) ? 1 : 0;
-                for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
-                        dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], false, now_abs);
-                dispatchKeyboardEventX(keyCode == 0x4e ? 0x90 : 0x91, goingDown, now_abs);
-                for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
-                        dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], true, now_abs);
-                keyCode = 0;
-            }
-            break;
-            
-        case 0x0153:    // delete
-            // check for Ctrl+Alt+Delete? (three finger salute)
-            if (checkModifierState(kMaskLeftControl|kMaskLeftAlt))
-            {
-                keyCode = 0;
-                if (!goingDown)
-                {
-                    // Note: If OS X thinks the Command and Control keys are down at the time of
-                    //  receiving an ADB 0x7f (power button), it will unconditionaly and unsafely
-                    //  reboot the computer, much like the old PC/AT Ctrl+Alt+Delete!
-                    // That's why we make sure Control (0x3b) and Alt (0x37) are up!!
-                    dispatchKeyboardEventX(0x37, false, now_abs);
-                    dispatchKeyboardEventX(0x3b, false, now_abs);
-                    dispatchKeyboardEventX(0x7f, true, now_abs);
-                    dispatchKeyboardEventX(0x7f, false, now_abs);
-                }
-            }
-            break;
-            
-        case 0x015f:    // sleep
-            keyCode = 0;
-            if (goingDown)
-            {
-                _timerFunc = kTimerSleep;
-                if (_fkeymode || !_maxsleeppresstime)
-                    onSleepEjectTimer();
-                else
-                    setTimerTimeout(_sleepEjectTimer, (uint64_t)_maxsleeppresstime * 1000000);
-            }
-            else
-            {
-                cancelTimer(_sleepEjectTimer);
-            }
-            break;
-            
-            //REVIEW: this is getting a bit ugly
-        case 0x0128:    // alternate that cannot fnkeys toggle (discrete trackpad toggle)
-        case 0x0137:    // prt sc/sys rq
-        {
-            unsigned origKeyCode = keyCode;
-            keyCode = 0;
-            if (!goingDown)
-                break;
-            if (!checkModifierState(kMaskLeftControl))
-            {
-                // get current enabled status, and toggle it
-                bool enabled;
-                _device->dispatchMouseMessage(kPS2M_getDisableTouchpad, &enabled);
-                enabled = !enabled;
-                _device->dispatchMouseMessage(kPS2M_setDisableTouchpad, &enabled);
-                break;
-            }
-            if (origKeyCode != 0x0137)
-                break; // do not fall through for 0x0128
-            // fall through
-        }
-        case 0x0127:    // alternate for fnkeys toggle (discrete fnkeys toggle)
-            keyCode = 0;
-            if (!goingDown)
-                break;
-            if (_fkeymodesupported)
-            {
-                // modify HIDFKeyMode via IOService... IOHIDSystem
-                if (IOService* service = IOService::waitForMatchingService(serviceMatching(kIOHIDSystem), 0))
-                {
-                    const OSObject* num = OSNumber::withNumber(!_fkeymode, 32);
-                    const OSString* key = OSString::withCString(kHIDFKeyMode);
-                    if (num && key)
-                    {
-                        if (OSDictionary* dict = OSDictionary::withObjects(&num, &key, 1))
-                        {
-                            service->setProperties(dict);
-                            dict->release();
-                        }
-                    }
-                    OSSafeReleaseNULL(num);
-                    OSSafeReleaseNULL(key);
-                    service->release();
-                }
-            }
+        const HotkeyEntry& hotkey = _hotkeys[i];
+        UInt16 state = _PS2modifierState & hotkey.mask;
+        if ((state == hotkey.compare || (0xFFFF == hotkey.compare && state)) &&
+            runHotkey(hotkey.action, keyCode, goingDown, now_abs))
             break;
     }
     
@@ -1839,6 +2022,7 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
 #endif
     if (logscancodes==2 || (logscancodes==1 && goingDown))
     {
+        // not rate limited: LogScanCodes is asked for, and used to build maps
         if (keyCode == keyCodeRaw)
             IOLog("%s: sending key %x=%x %s\n", getName(), keyCode > KBV_NUM_SCANCODES ? (keyCode & 0xFF) | 0xe000 : keyCode, adbKeyCode, goingDown?"down":"up");
         else
@@ -1884,6 +2068,18 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
             dispatchKeyboardEventX(adbKeyCode, false, now_abs);
     }
     
+    if (keyCode && _telemetry && _telemetry->enabled())
+    {
+        // now_abs is still the arrival time of the scan code; timing only,
+        // never which key (see PS2Telemetry.h)
+        uint64_t dispatch_abs;
+        clock_get_uptime(&dispatch_abs);
+        if (info.eatKey)
+            _telemetry->write(kPS2TS_Keyboard, kPS2TE_Drop, kPS2TD_KeyEaten, dispatch_abs);
+        else
+            _telemetry->write(kPS2TS_Keyboard, kPS2TE_Dispatch, 0, dispatch_abs, 0, 0, 0, (SInt32)(dispatch_abs - now_abs));
+    }
+    
 #ifdef DEBUG
     if (0x38 == keyCode && !goingDown && -1 != genADB) // Alt going up
     {
@@ -2015,7 +2211,7 @@ void ApplePS2Keyboard::setLEDs(UInt8 ledState)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Keyboard::setKeyboardEnable(bool enable)
+bool ApplePS2Keyboard::setKeyboardEnable(bool enable)
 {
     //
     // Instructs the keyboard to start or stop the reporting of key events.
@@ -2035,6 +2231,8 @@ void ApplePS2Keyboard::setKeyboardEnable(bool enable)
     request.commandsCount = 2;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
+    
+    return 2 == request.commandsCount;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -2295,11 +2493,23 @@ void ApplePS2Keyboard::setDevicePowerState( UInt32 whatToDo )
     switch ( whatToDo )
     {
         case kPS2C_DisableDevice:
+        {
             //
-            // Disable keyboard.
+            // Disable keyboard.  The disable command also restores the
+            // keyboard defaults, so if it was acknowledged there is no need
+            // to send Set Defaults again on wake.
             //
-            setKeyboardEnable( false );
+            uint64_t start, now;
+            clock_get_uptime(&start);
+            
+            _suspendedFast = setKeyboardEnable( false ) && _fastsuspend;
+            
+            // suspend latency telemetry
+            clock_get_uptime(&now);
+            absolutetime_to_nanoseconds(now - start, &now);
+            setProperty("SuspendTime", (UInt32)(now / 1000), 32);
             break;
+        }
             
         case kPS2C_EnableDevice:
             //
@@ -2315,17 +2525,23 @@ void ApplePS2Keyboard::setDevicePowerState( UInt32 whatToDo )
 void ApplePS2Keyboard::initKeyboard()
 {
     //
-    // Reset the keyboard to its default state.
+    // Reset the keyboard to its default state.  Skipped after a fast
+    // suspend: the disable sent at sleep already restored the defaults,
+    // and a keyboard that lost power comes back with them anyway.
     //
     
-    TPS2Request<2> request;
-    request.commands[0].command = kPS2C_WriteDataPort;
-    request.commands[0].inOrOut = kDP_SetDefaults;
-    request.commands[1].command = kPS2C_ReadDataPortAndCompare;
-    request.commands[1].inOrOut = kSC_Acknowledge;
-    request.commandsCount = 2;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
+    if (!_suspendedFast)
+    {
+        TPS2Request<2> request;
+        request.commands[0].command = kPS2C_WriteDataPort;
+        request.commands[0].inOrOut = kDP_SetDefaults;
+        request.commands[1].command = kPS2C_ReadDataPortAndCompare;
+        request.commands[1].inOrOut = kSC_Acknowledge;
+        request.commandsCount = 2;
+        assert(request.commandsCount <= countof(request.commands));
+        _device->submitRequestAndBlock(&request);
+    }
+    _suspendedFast = false;
     
     // look for any keys that are down (just in case the reset happened with keys down)
     // for each key that is down, dispatch a key up for it
@@ -81,6 +81,8 @@ private:
     bool                        _powerControlHandlerInstalled;
     bool                        _messageHandlerInstalled;
     UInt8                       _ledState;
+    bool                        _fastsuspend;
+    bool                        _suspendedFast;
     IOCommandGate*              _cmdGate;
 
     // for keyboard remapping
@@ -95,6 +97,16 @@ private:
     OSArray*                    _keysSpecial;
     bool                        _swapcommandoption;
     int                         _logscancodes;
+    
+    // hot path logging (see PS2EventLog)
+    enum
+    {
+        kLogUnexpectedReset,
+        kLogUnexpectedAck,
+        kLogUnexpectedResend,
+    };
+    PS2EventLog<64>             _eventLog;
+    PS2TelemetryRing*           _telemetry;
     UInt32                      _f12ejectdelay;
     enum { kTimerSleep, kTimerEject } _timerFunc;
     
@@ -124,6 +136,28 @@ private:
     // special hack for Envy brightness access, while retaining F2/F3 functionality
     bool                        _brightnessHack;
     
+    // hotkeys, grouped by key code (see compileHotkeys)
+    enum
+    {
+        kHotkeyPass,            // stop looking, key goes through as usual
+        kHotkeyEat,             // stop looking, key is dropped
+        kHotkeyBacklight,
+        kHotkeyBrightness,      // Envy brightness hack
+        kHotkeyPower,
+        kHotkeySleep,
+        kHotkeyTouchpad,
+        kHotkeyFnKeys,
+        kHotkeyActionCount
+    };
+    struct HotkeyEntry
+    {
+        UInt16 mask;            // modifier bits looked at
+        UInt16 compare;         // required value, 0xFFFF for any of mask
+        UInt8 action;
+    };
+    HotkeyEntry*                _hotkeys;
+    UInt16                      _hotkeyStart[KBV_NUM_SCANCODES*2+1];  // key code k uses [_hotkeyStart[k], _hotkeyStart[k+1])
+    
     // macro processing
     OSData**                    _macroTranslation;
     OSData**                    _macroInversion;
@@ -135,7 +169,7 @@ private:
     
     virtual bool dispatchKeyboardEventWithPacket(const UInt8* packet);
     virtual void setLEDs(UInt8 ledState);
-    virtual void setKeyboardEnable(bool enable);
+    virtual bool setKeyboardEnable(bool enable);
     virtual void initKeyboard();
     virtual void setDevicePowerState(UInt32 whatToDo);
     void sendKeySequence(UInt16* pKeys);
@@ -147,6 +181,8 @@ private:
     void loadCustomPS2Map(OSArray* pArray);
     void loadBreaklessPS2(OSDictionary* dict, const char* name);
     void loadCustomADBMap(OSDictionary* dict, const char* name);
+    void compileHotkeys(OSArray* pArray);
+    bool runHotkey(int action, unsigned& keyCode, bool goingDown, uint64_t now_abs);
     void setParamPropertiesGated(OSDictionary* dict);
     void onSleepEjectTimer(void);
     
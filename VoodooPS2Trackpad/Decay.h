@@ -132,4 +132,120 @@ public:
 };
 
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// MotionPredictor Class Declaration
+//
+// Extrapolates one axis a fixed horizon ahead from the last three samples
+// (velocity plus half the acceleration term).  Integer only, times in us.
+// advance() returns how much the prediction offset moved since the last
+// sample, so a relative pointer stays "offset" ahead of the finger and
+// gives it back as the finger slows down.
+//
+// reset() returns the lead that was already given out, for the caller to
+// take back; otherwise every stroke would leave the pointer one prediction
+// ahead of where the finger stopped.
+//
+// Each prediction is also checked against the sample that arrives once its
+// horizon has passed, against the error of not predicting at all (which is
+// how far the finger moved in that time).  errorSum() < baselineSum()
+// means prediction is winning back latency.
+//
+
+class MotionPredictor
+{
+private:
+    enum { kMaxGap = 100000 };  // us without samples before history is stale
+    int m_x[3];
+    uint64_t m_t[3];
+    int m_count;
+    int m_offset;
+    // evaluation
+    uint64_t m_checkTime;
+    int m_checkPredicted;
+    int m_checkBase;
+    uint64_t m_errorSum;
+    uint64_t m_baselineSum;
+    UInt32 m_samples;
+    
+public:
+    inline MotionPredictor() { reset(); m_errorSum = m_baselineSum = 0; m_samples = 0; }
+    int advance(int x, uint64_t t, int horizon)
+    {
+        if (m_count && (t <= m_t[0] || t - m_t[0] > kMaxGap))
+        {
+            int result = -m_offset;
+            reset();
+            m_x[0] = x; m_t[0] = t; m_count = 1;
+            return result;
+        }
+        
+        // score the outstanding prediction
+        if (m_checkTime && t >= m_checkTime)
+        {
+            int error = m_checkPredicted - x;
+            int base = m_checkBase - x;
+            m_errorSum += error < 0 ? -error : error;
+            m_baselineSum += base < 0 ? -base : base;
+            ++m_samples;
+            m_checkTime = 0;
+        }
+        
+        m_x[2] = m_x[1]; m_t[2] = m_t[1];
+        m_x[1] = m_x[0]; m_t[1] = m_t[0];
+        m_x[0] = x; m_t[0] = t;
+        if (m_count < 3)
+            ++m_count;
+        
+        int offset = 0;
+        if (m_count >= 2)
+        {
+            int64_t d1 = m_x[0] - m_x[1];
+            int64_t dt1 = m_t[0] - m_t[1];
+            int64_t h = horizon;
+            int64_t vel = d1 * h / dt1;
+            int64_t acc = 0;
+            if (m_count >= 3)
+            {
+                int64_t d2 = m_x[1] - m_x[2];
+                int64_t dt2 = m_t[1] - m_t[2];
+                if ((d1 < 0 && d2 > 0) || (d1 > 0 && d2 < 0))
+                    vel = 0;    // direction change: do not overshoot the turn
+                else
+                    acc = (d1 * dt2 - d2 * dt1) * h / dt1 * h / (dt2 * (dt1 + dt2));
+            }
+            // deceleration may pull the prediction back to zero, never past it,
+            // and acceleration may at most double it
+            int64_t pred = vel + acc;
+            if (vel >= 0)
+                pred = pred < 0 ? 0 : pred > 2*vel ? 2*vel : pred;
+            else
+                pred = pred > 0 ? 0 : pred < 2*vel ? 2*vel : pred;
+            offset = (int)pred;
+        }
+        
+        if (!m_checkTime && horizon)
+        {
+            m_checkTime = t + horizon;
+            m_checkPredicted = x + offset;
+            m_checkBase = x;
+        }
+        
+        int result = offset - m_offset;
+        m_offset = offset;
+        return result;
+    }
+    inline int reset()
+    {
+        int result = -m_offset;
+        m_count = 0;
+        m_offset = 0;
+        m_checkTime = 0;
+        return result;
+    }
+    inline uint64_t errorSum() { return m_errorSum; }
+    inline uint64_t baselineSum() { return m_baselineSum; }
+    inline UInt32 samples() { return m_samples; }
+};
+
+
 #endif
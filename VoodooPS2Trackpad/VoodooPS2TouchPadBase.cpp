@@ -6,6 +6,7 @@
 #include <IOKit/hidsystem/IOHIDParameter.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <libkern/OSAtomic.h>
 #include "VoodooPS2Controller.h"
 #include "VoodooPS2TouchPadBase.h"
 
@@ -56,14 +57,54 @@ bool VoodooPS2TouchPadBase::init(OSDictionary * dict)
 #endif
     }
     
+    // per-packet state, on a cache line of its own (see TouchPadFrame)
+    _frame = (TouchPadFrame*)IOMallocAligned(frameSize(), kFrameAlign);
+    if (!_frame)
+    {
+        OSSafeReleaseNULL(config);
+        return false;
+    }
+    bzero(_frame, frameSize());
+    _benchRunning = false;
+    
     // initialize state...
     _device = NULL;
     _interruptHandlerInstalled = false;
     _powerControlHandlerInstalled = false;
     _messageHandlerInstalled = false;
     _packetByteCount = 0;
+    _eventLog.init(NULL, 0);
+    _telemetry = NULL;
     _lastdata = 0;
     _cmdGate = 0;
+    _wakeReadyTime = 0;
+    _wakeReadyTimeMax = 0;
+    _wakeReset = false;
+    _initThreadCall = 0;
+    _initLock = 0;
+    _initStopped = false;
+    _startTime = 0;
+    _pendingParams = NULL;
+    _fullRate = 0;
+    _rateIdle = false;
+    _rateTimerArmed = false;
+    _idleRateTimer = 0;
+    _idlePackets = _idleRatePackets = _idleRateSwitches = 0;
+    _recoveryLevel = kRecoverNone;
+    _recoveryPending = false;
+    _recoveryTimer = 0;
+    _recoveryThreadCall = 0;
+    _badConsecutive = _badWindow = _goodSinceRecovery = 0;
+    _badWindowStart = _recoveryStart = _recoveryNext = 0;
+    _recoveryBackoff = 0;
+    bzero(_recoverySteps, sizeof(_recoverySteps));
+    _recoveryTime = _recoveryTimeMax = 0;
+    _paramsLock = IOLockAlloc();
+    if (!_paramsLock)
+    {
+        OSSafeReleaseNULL(config);
+        return false;
+    }
 
     // set defaults for configuration items
     
@@ -108,6 +149,14 @@ bool VoodooPS2TouchPadBase::init(OSDictionary * dict)
     mousescrollmultipliery = 20;
     mousemiddlescroll = true;
     wakedelay = 1000;
+    fastsuspend = true;
+    idlerate = 40;
+    idleratetimeout = 2000;
+    recoverybad = 8;
+    recoverywindow = 1000;
+    recoverywindowbad = 32;
+    recoverybackoff = 2000;
+    predictahead = 0;
     skippassthru = false;
     tapthreshx = tapthreshy = 50;
     dblthreshx = dblthreshy = 100;
@@ -118,6 +167,8 @@ bool VoodooPS2TouchPadBase::init(OSDictionary * dict)
     diszctrl = 0;
     _resolution = 2300;
     _scrollresolution = 2300;
+    scrollsubdiv = 8;
+    _scrollUnits = 1;
     swipedx = swipedy = 800;
     rczl = 3800; rczt = 2000;
     rczr = 99999; rczb = 0;
@@ -163,9 +214,17 @@ bool VoodooPS2TouchPadBase::init(OSDictionary * dict)
     _buttontime = 0;
     _maxmiddleclicktime = 100000000;
     _fakemiddlebutton = true;
+    _immediatemiddle = false;
+    _middleImmediate = _middleConversions = 0;
+    _middleLatencySaved = 0;
+    _emittedButtons = 0;
+    _eventsEmitted = _eventsSuppressed = 0;
     
     ignoredeltas=0;
     ignoredeltasstart=0;
+    fingerdebounce=2;
+    _fingersStable=_fingersCandidate=_fingersPending=_debounceZ=0;
+    _fingersCarried=false;
 	scrollrest=0;
     touchtime=untouchtime=0;
 	wastriple=wasdouble=false;
@@ -209,12 +268,55 @@ bool VoodooPS2TouchPadBase::init(OSDictionary * dict)
     
     setParamPropertiesGated(config);
     OSSafeReleaseNULL(config);
+    adoptParams();
+    // the defaults need their tables too when there was no configuration
+    buildZoneMap();
     
     return true;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void VoodooPS2TouchPadBase::free()
+{
+    //
+    // Release any configuration snapshot the packet path never picked up.
+    //
+
+    TouchPadParams* params = exchangeParams(NULL);
+    if (params)
+        IOFree(params, sizeof(TouchPadParams));
+    if (_paramsLock)
+    {
+        IOLockFree(_paramsLock);
+        _paramsLock = 0;
+    }
+    if (_frame)
+    {
+        IOFreeAligned(_frame, frameSize());
+        _frame = 0;
+    }
+    if (_initThreadCall)
+    {
+        thread_call_free(_initThreadCall);
+        _initThreadCall = 0;
+    }
+    if (_recoveryThreadCall)
+    {
+        thread_call_free(_recoveryThreadCall);
+        _recoveryThreadCall = 0;
+    }
+    if (_initLock)
+    {
+        IOLockFree(_initLock);
+        _initLock = 0;
+    }
+
+    super::free();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 bool VoodooPS2TouchPadBase::start( IOService * provider )
 {
     //
@@ -222,6 +324,8 @@ bool VoodooPS2TouchPadBase::start( IOService * provider )
     // successful probe and match.
     //
 
+    clock_get_uptime(&_startTime);
+
     if (!super::start(provider))
         return false;
 
@@ -231,6 +335,16 @@ bool VoodooPS2TouchPadBase::start( IOService * provider )
 
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _telemetry = _device->getTelemetry();
+    
+    //
+    // Subclass init may have adjusted the active parameters after the
+    // Platform Profile was loaded, so later updates must build on those.
+    //
+    
+    IOLockLock(_paramsLock);
+    _paramsMaster = *static_cast<TouchPadParams*>(this);
+    IOLockUnlock(_paramsLock);
     
     //
     // Advertise the current state of the tapping feature.
@@ -242,9 +356,16 @@ bool VoodooPS2TouchPadBase::start( IOService * provider )
 
     setProperty(kIOHIDPointerAccelerationTypeKey, kIOHIDTrackpadAccelerationType);
     setProperty(kIOHIDScrollAccelerationTypeKey, kIOHIDTrackpadScrollAccelerationKey);
-	setProperty(kIOHIDScrollResolutionKey, _scrollresolution << 16, 32);
-    setProperty("HIDScrollResolutionX", _scrollresolution << 16, 32);
-    setProperty("HIDScrollResolutionY", _scrollresolution << 16, 32);
+    //
+    // Scroll deltas go out in 1/scrollsubdiv lines, and the advertised
+    // resolution is raised to match, so the distance scrolled stays the
+    // same but slow scrolls no longer arrive as bursts of whole lines.
+    //
+    
+    _frame->_scrollUnits = scrollsubdiv;
+	setProperty(kIOHIDScrollResolutionKey, (_scrollresolution * _frame->_scrollUnits) << 16, 32);
+    setProperty("HIDScrollResolutionX", (_scrollresolution * _frame->_scrollUnits) << 16, 32);
+    setProperty("HIDScrollResolutionY", (_scrollresolution * _frame->_scrollUnits) << 16, 32);
     
     //
     // Setup workloop with command gate for thread synchronization...
@@ -295,41 +416,41 @@ bool VoodooPS2TouchPadBase::start( IOService * provider )
         pWorkLoop->addEventSource(scrollTimer);
     
     //
-    // Lock the controller during initialization
+    // Setup idle report rate timer event source
     //
+    _idleRateTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooPS2TouchPadBase::onIdleRateTimer));
+    if (_idleRateTimer)
+        pWorkLoop->addEventSource(_idleRateTimer);
     
-    _device->lock();
-
-
     //
-    // Perform any implementation specific device initialization
+    // Setup bad packet recovery timer event source
     //
-    if (!deviceSpecificInit()) {
-        _device->unlock();
-        _device->release();
-        // TODO: any other cleanup?
-        return false;
-    }
-
+    _recoveryTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooPS2TouchPadBase::onRecoveryTimer));
+    if (_recoveryTimer)
+        pWorkLoop->addEventSource(_recoveryTimer);
+    _recoveryBackoff = recoverybackoff;
+    _recoveryThreadCall = thread_call_allocate((thread_call_func_t)restartCallout, (thread_call_param_t)this);
+    
     //
-    // Install our driver's interrupt handler, for asynchronous data delivery.
+    // Device initialization (hw_init for ALPS) is hundreds of blocking PS/2
+    // transactions, so it runs in the background instead of holding up start
+    // and the rest of boot.  Each transaction is a separate request, so the
+    // keyboard keeps working meanwhile.  The interrupt and power handlers
+    // are installed once the device is ready (see initDevice).
     //
     
-    _device->installInterruptAction(this,
-                                    OSMemberFunctionCast(PS2InterruptAction,this,&VoodooPS2TouchPadBase::interruptOccurred),
-                                    OSMemberFunctionCast(PS2PacketAction, this, &VoodooPS2TouchPadBase::packetReady));
-    _interruptHandlerInstalled = true;
-    
-    // now safe to allow other threads
-    _device->unlock();
-    
-    //
-	// Install our power control handler.
-	//
+    _initLock = IOLockAlloc();
+    _initThreadCall = thread_call_allocate((thread_call_func_t)initCallout, (thread_call_param_t)this);
+    if (!_initLock || !_initThreadCall)
+    {
+        _device->release();
+        return false;
+    }
     
-	_device->installPowerControlAction( this,
-        OSMemberFunctionCast(PS2PowerControlAction, this, &VoodooPS2TouchPadBase::setDevicePowerState) );
-	_powerControlHandlerInstalled = true;
+    // initCallout drops these
+    retain();
+    _device->retain();
+    thread_call_enter1(_initThreadCall, (thread_call_param_t)_device);
     
     //
     // Install message hook for keyboard to trackpad communication
@@ -339,11 +460,94 @@ bool VoodooPS2TouchPadBase::start( IOService * provider )
         OSMemberFunctionCast(PS2MessageAction, this, &VoodooPS2TouchPadBase::receiveMessage));
     _messageHandlerInstalled = true;
 
+    uint64_t now;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - _startTime, &now);
+    setProperty("BootStartTime", (UInt32)(now / 1000), 32);
+    
     return true;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void VoodooPS2TouchPadBase::initCallout(thread_call_param_t param0, thread_call_param_t param1)
+{
+    VoodooPS2TouchPadBase* me = (VoodooPS2TouchPadBase*)param0;
+    ApplePS2MouseDevice* device = (ApplePS2MouseDevice*)param1;
+    assert(me && device);
+    
+    me->initDevice(device);
+    
+    // drop the retains from start()
+    device->release();
+    me->release();
+}
+
+void VoodooPS2TouchPadBase::initDevice(ApplePS2MouseDevice* device)
+{
+    //
+    // Runs on a thread call, not on the workloop.  stop() takes _initLock
+    // too, so it either waits for us to finish or we see _initStopped and
+    // never touch the device.
+    //
+    
+    IOLockLock(_initLock);
+    if (_initStopped)
+    {
+        IOLockUnlock(_initLock);
+        return;
+    }
+    
+    uint64_t begin, now;
+    clock_get_uptime(&begin);
+    
+    //
+    // Perform any implementation specific device initialization.  The
+    // knock sequences must not interleave with other users of the
+    // controller (keyboard init runs at the same time now), so hold the
+    // device lock as start() used to.
+    //
+    
+    device->lock();
+    bool success = deviceSpecificInit();
+    device->unlock();
+    
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - begin, &begin);
+    setProperty("BootInitTime", (UInt32)(begin / 1000), 32);
+    
+    if (success)
+    {
+        //
+        // Install our driver's interrupt handler, for asynchronous data delivery.
+        //
+        
+        device->installInterruptAction(this,
+                                       OSMemberFunctionCast(PS2InterruptAction,this,&VoodooPS2TouchPadBase::interruptOccurred),
+                                       OSMemberFunctionCast(PS2PacketAction, this, &VoodooPS2TouchPadBase::packetReady));
+        _interruptHandlerInstalled = true;
+        
+        //
+        // Install our power control handler.
+        //
+        
+        device->installPowerControlAction( this,
+            OSMemberFunctionCast(PS2PowerControlAction, this, &VoodooPS2TouchPadBase::setDevicePowerState) );
+        _powerControlHandlerInstalled = true;
+        
+        // time from start() until the pointer is live
+        clock_get_uptime(&now);
+        absolutetime_to_nanoseconds(now - _startTime, &now);
+        setProperty("BootReadyTime", (UInt32)(now / 1000), 32);
+    }
+    else
+        IOLog("%s: device initialization failed, touchpad disabled\n", getName());
+    
+    IOLockUnlock(_initLock);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void VoodooPS2TouchPadBase::stop( IOService * provider )
 {
     DEBUG_LOG("%s: stop called\n", getName());
@@ -356,6 +560,19 @@ void VoodooPS2TouchPadBase::stop( IOService * provider )
 
     assert(_device == provider);
 
+    //
+    // Make sure background initialization is finished, or never starts.
+    //
+    
+    if (_initLock)
+    {
+        IOLockLock(_initLock);
+        _initStopped = true;
+        IOLockUnlock(_initLock);
+    }
+    if (_recoveryThreadCall && thread_call_cancel(_recoveryThreadCall))
+        release();  // restartCallout never runs
+    
     // free up timer for scroll momentum
     IOWorkLoop* pWorkLoop = getWorkLoop();
     if (pWorkLoop)
@@ -372,6 +589,18 @@ void VoodooPS2TouchPadBase::stop( IOService * provider )
             _buttonTimer->release();
             _buttonTimer = 0;
         }
+        if (_idleRateTimer)
+        {
+            pWorkLoop->removeEventSource(_idleRateTimer);
+            _idleRateTimer->release();
+            _idleRateTimer = 0;
+        }
+        if (_recoveryTimer)
+        {
+            pWorkLoop->removeEventSource(_recoveryTimer);
+            _recoveryTimer->release();
+            _recoveryTimer = 0;
+        }
         if (_cmdGate)
         {
             pWorkLoop->removeEventSource(_cmdGate);
@@ -427,24 +656,25 @@ void VoodooPS2TouchPadBase::onScrollTimer(void)
     // momentum scroll.
     //
     
-    if (!momentumscrollcurrent)
+    if (!_frame->momentumscrollcurrent)
         return;
     
     uint64_t now_abs;
 	clock_get_uptime(&now_abs);
     
-    int64_t dy64 = momentumscrollcurrent / (int64_t)momentumscrollinterval + momentumscrollrest2;
+    int64_t dy64 = _frame->momentumscrollcurrent / (int64_t)_frame->momentumscrollinterval + _frame->momentumscrollrest2;
     int dy = (int)dy64;
-    if (abs(dy) > momentumscrollthreshy)
+    // dy_history, and so momentumscrollcurrent, is in scroll units already
+    if (abs(dy) > momentumscrollthreshy * _frame->_scrollUnits)
     {
         // dispatch the scroll event
         dispatchScrollWheelEventX(wvdivisor ? dy / wvdivisor : 0, 0, 0, now_abs);
-        momentumscrollrest2 = wvdivisor ? dy % wvdivisor : 0;
+        _frame->momentumscrollrest2 = wvdivisor ? dy % wvdivisor : 0;
     
         // adjust momentumscrollcurrent
-        momentumscrollcurrent = momentumscrollcurrent * momentumscrollmultiplier + momentumscrollrest1;
-        momentumscrollrest1 = momentumscrollcurrent % momentumscrolldivisor;
-        momentumscrollcurrent /= momentumscrolldivisor;
+        _frame->momentumscrollcurrent = _frame->momentumscrollcurrent * momentumscrollmultiplier + _frame->momentumscrollrest1;
+        _frame->momentumscrollrest1 = _frame->momentumscrollcurrent % momentumscrolldivisor;
+        _frame->momentumscrollcurrent /= momentumscrolldivisor;
         
         // start another timer
         setTimerTimeout(scrollTimer, momentumscrolltimer);
@@ -452,7 +682,7 @@ void VoodooPS2TouchPadBase::onScrollTimer(void)
     else
     {
         // no more scrolling...
-        momentumscrollcurrent = 0;
+        _frame->momentumscrollcurrent = 0;
     }
 }
 
@@ -463,42 +693,50 @@ void VoodooPS2TouchPadBase::onButtonTimer(void)
 	uint64_t now_abs;
 	clock_get_uptime(&now_abs);
     
-    middleButton(lastbuttons, now_abs, fromTimer);
+    middleButton(_frame->lastbuttons, now_abs, fromTimer);
 }
 
 UInt32 VoodooPS2TouchPadBase::middleButton(UInt32 buttons, uint64_t now_abs, MBComingFrom from)
 {
-    if (!_fakemiddlebutton || _buttonCount <= 2 || (ignoreall && fromTrackpad == from))
+    if (!_fakemiddlebutton || _buttonCount <= 2 || (_frame->ignoreall && fromTrackpad == from))
         return buttons;
     
     // cancel timer if we see input before timeout has fired, but after expired
     bool timeout = false;
     uint64_t now_ns;
     absolutetime_to_nanoseconds(now_abs, &now_ns);
-    if (fromTimer == from || fromCancel == from || now_ns - _buttontime > _maxmiddleclicktime)
+    if (fromTimer == from || fromCancel == from || now_ns - _frame->_buttontime > _maxmiddleclicktime)
         timeout = true;
 
     //
     // A state machine to simulate middle buttons with two buttons pressed
     // together.
     //
-    switch (_mbuttonstate)
+    switch (_frame->_mbuttonstate)
     {
         // no buttons down, waiting for something to happen
         case STATE_NOBUTTONS:
             if (fromCancel != from)
             {
                 if (buttons & 0x4)
-                    _mbuttonstate = STATE_NOOP;
+                    _frame->_mbuttonstate = STATE_NOOP;
                 else if (0x3 == buttons)
-                    _mbuttonstate = STATE_MIDDLE;
+                    _frame->_mbuttonstate = STATE_MIDDLE;
+                else if (0x0 != buttons && _immediatemiddle)
+                {
+                    // only single button, deliver it now, but remember it
+                    // for a bit in case the second one follows
+                    _frame->_pendingbuttons = buttons;
+                    _frame->_buttontime = now_ns;
+                    _frame->_mbuttonstate = STATE_PASS4TWO;
+                }
                 else if (0x0 != buttons)
                 {
                     // only single button, so delay this for a bit
-                    _pendingbuttons = buttons;
-                    _buttontime = now_ns;
+                    _frame->_pendingbuttons = buttons;
+                    _frame->_buttontime = now_ns;
                     setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                    _mbuttonstate = STATE_WAIT4TWO;
+                    _frame->_mbuttonstate = STATE_WAIT4TWO;
                 }
             }
             break;
@@ -507,34 +745,60 @@ UInt32 VoodooPS2TouchPadBase::middleButton(UInt32 buttons, uint64_t now_abs, MBC
         case STATE_WAIT4TWO:
             if (!timeout && 0x3 == buttons)
             {
-                _pendingbuttons = 0;
+                _frame->_pendingbuttons = 0;
                 cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_MIDDLE;
+                _frame->_mbuttonstate = STATE_MIDDLE;
             }
-            else if (timeout || buttons != _pendingbuttons)
+            else if (timeout || buttons != _frame->_pendingbuttons)
             {
-                if (fromTimer == from || !(buttons & _pendingbuttons))
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
+                if (fromTimer == from || !(buttons & _frame->_pendingbuttons))
+                    dispatchRelativePointerEventX(0, 0, buttons|_frame->_pendingbuttons, now_abs);
+                _frame->_pendingbuttons = 0;
                 cancelTimer(_buttonTimer);
                 if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
+                    _frame->_mbuttonstate = STATE_NOBUTTONS;
+                else
+                    _frame->_mbuttonstate = STATE_NOOP;
+            }
+            break;
+            
+        // single button already delivered, waiting for the second or timeout
+        case STATE_PASS4TWO:
+            if (!timeout && 0x3 == buttons)
+            {
+                // chord after all: release the first, in place, then go middle
+                dispatchRelativePointerEventX(0, 0, buttons & ~0x3, now_abs);
+                _frame->_pendingbuttons = 0;
+                ++_middleConversions;
+                _frame->_mbuttonstate = STATE_MIDDLE;
+                setProperty("MiddleConversions", _middleConversions, 32);
+            }
+            else if (timeout || buttons != _frame->_pendingbuttons)
+            {
+                // what the press would have waited in STATE_WAIT4TWO
+                _middleLatencySaved += timeout ? _maxmiddleclicktime : now_ns - _frame->_buttontime;
+                ++_middleImmediate;
+                _frame->_pendingbuttons = 0;
+                if (0x0 == buttons)
+                    _frame->_mbuttonstate = STATE_NOBUTTONS;
                 else
-                    _mbuttonstate = STATE_NOOP;
+                    _frame->_mbuttonstate = STATE_NOOP;
+                setProperty("MiddleImmediateClicks", _middleImmediate, 32);
+                setProperty("MiddleLatencySaved", (UInt32)(_middleLatencySaved / 1000), 32);
             }
             break;
             
         // both buttons down and delivering middle button
         case STATE_MIDDLE:
             if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
+                _frame->_mbuttonstate = STATE_NOBUTTONS;
             else if (0x3 != (buttons & 0x3))
             {
                 // only single button, so delay to see if we get to none
-                _pendingbuttons = buttons;
-                _buttontime = now_ns;
+                _frame->_pendingbuttons = buttons;
+                _frame->_buttontime = now_ns;
                 setTimerTimeout(_buttonTimer, _maxmiddleclicktime);
-                _mbuttonstate = STATE_WAIT4NONE;
+                _frame->_mbuttonstate = STATE_WAIT4NONE;
             }
             break;
             
@@ -542,31 +806,31 @@ UInt32 VoodooPS2TouchPadBase::middleButton(UInt32 buttons, uint64_t now_abs, MBC
         case STATE_WAIT4NONE:
             if (!timeout && 0x0 == buttons)
             {
-                _pendingbuttons = 0;
+                _frame->_pendingbuttons = 0;
                 cancelTimer(_buttonTimer);
-                _mbuttonstate = STATE_NOBUTTONS;
+                _frame->_mbuttonstate = STATE_NOBUTTONS;
             }
-            else if (timeout || buttons != _pendingbuttons)
+            else if (timeout || buttons != _frame->_pendingbuttons)
             {
                 if (fromTimer == from)
-                    dispatchRelativePointerEventX(0, 0, buttons|_pendingbuttons, now_abs);
-                _pendingbuttons = 0;
+                    dispatchRelativePointerEventX(0, 0, buttons|_frame->_pendingbuttons, now_abs);
+                _frame->_pendingbuttons = 0;
                 cancelTimer(_buttonTimer);
                 if (0x0 == buttons)
-                    _mbuttonstate = STATE_NOBUTTONS;
+                    _frame->_mbuttonstate = STATE_NOBUTTONS;
                 else
-                    _mbuttonstate = STATE_NOOP;
+                    _frame->_mbuttonstate = STATE_NOOP;
             }
             break;
             
         case STATE_NOOP:
             if (0x0 == buttons)
-                _mbuttonstate = STATE_NOBUTTONS;
+                _frame->_mbuttonstate = STATE_NOBUTTONS;
             break;
     }
     
     // modify buttons after new state set
-    switch (_mbuttonstate)
+    switch (_frame->_mbuttonstate)
     {
         case STATE_MIDDLE:
             buttons = 0x4;
@@ -578,6 +842,7 @@ UInt32 VoodooPS2TouchPadBase::middleButton(UInt32 buttons, uint64_t now_abs, MBC
             break;
             
         case STATE_NOBUTTONS:
+        case STATE_PASS4TWO:
         case STATE_NOOP:
             break;
     }
@@ -590,20 +855,20 @@ UInt32 VoodooPS2TouchPadBase::middleButton(UInt32 buttons, uint64_t now_abs, MBC
 
 void VoodooPS2TouchPadBase::onDragTimer(void)
 {
-    if (MODE_DRAGNOTOUCH==touchmode)
+    if (MODE_DRAGNOTOUCH==_frame->touchmode)
     {
-        touchmode=MODE_NOTOUCH;
+        _frame->touchmode=MODE_NOTOUCH;
         
         uint64_t now_abs;
         clock_get_uptime(&now_abs);
-        UInt32 buttons = middleButton(lastbuttons & ~0x01, now_abs, fromPassthru);
+        UInt32 buttons = middleButton(_frame->lastbuttons & ~0x01, now_abs, fromPassthru);
         DEBUG_LOG("ps2: onDragTimer, button = %d\n", buttons);
         dispatchRelativePointerEventX(0, 0, buttons, now_abs);
     }
     else
     {
         //REVIEW: for debugging...
-        IOLog("rehab: onDragTimer called with unexpected mode = %d\n", touchmode);
+        IOLog("rehab: onDragTimer called with unexpected mode = %d\n", _frame->touchmode);
     }
     //TODO: cancel dragnotouch mode, revert to notouch
     //TODO: send lbutton up without modifying other buttons
@@ -613,7 +878,295 @@ void VoodooPS2TouchPadBase::onDragTimer(void)
 
 void VoodooPS2TouchPadBase::onScrollDebounceTimer(void)
 {
-    scrolldebounce = false;
+    _frame->scrolldebounce = false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+int VoodooPS2TouchPadBase::debounceFingers(int fingers, int z)
+{
+    //
+    // A lower finger count is passed on once it has been seen in
+    // fingerdebounce packets in a row; until then the old count stands
+    // (and _fingersPending says so).  While the pressure is still falling
+    // it is most likely fingers leaving one after the other (2, 1, 0), so
+    // that has to hold twice as long.  A higher count, like touch down and
+    // full lift, goes through at once: holding it would turn a quick two
+    // finger tap (1, 2, 0) into a one finger tap.
+    //
+    // _fingersCarried says the change just passed on was held first, so
+    // the caller has followed the position across it.
+    //
+    
+    int lastz = _frame->_debounceZ;
+    _frame->_debounceZ = z;
+    _frame->_fingersCarried = false;
+    if (fingerdebounce <= 1 || fingers >= _frame->_fingersStable || !fingers)
+    {
+        _frame->_fingersStable = fingers;
+        _frame->_fingersPending = 0;
+        return fingers;
+    }
+    
+    if (fingers != _frame->_fingersCandidate)
+    {
+        _frame->_fingersCandidate = fingers;
+        _frame->_fingersPending = 0;
+    }
+    int needed = fingerdebounce;
+    if (fingers < _frame->_fingersStable && z < lastz)
+        needed *= 2;
+    if (++_frame->_fingersPending < needed)
+        return _frame->_fingersStable;
+    
+    _frame->_fingersStable = fingers;
+    _frame->_fingersPending = 0;
+    _frame->_fingersCarried = true;
+    return fingers;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void VoodooPS2TouchPadBase::updateReportRate(bool active)
+{
+    //
+    // Called for every packet.  After IdleRateTimeout ms without contact
+    // the device is switched to IdleSampleRate, and the first packet with
+    // contact switches it back.  At that point the packet is already here,
+    // so the only added latency is one idle sample interval on first touch
+    // (25 ms at the default 40, well inside MaxTapTime), and the switch
+    // back is only queued so the packet loop does not wait for it.
+    //
+    
+    if (!_fullRate || !idlerate || !_idleRateTimer)
+        return;
+    
+    if (_rateIdle)
+    {
+        ++_idleRatePackets;
+        if (active)
+            restoreReportRate(false);
+    }
+    else if (!active)
+    {
+        ++_idlePackets;
+        if (!_rateTimerArmed)
+        {
+            _idleRateTimer->setTimeoutMS(idleratetimeout);
+            _rateTimerArmed = true;
+        }
+    }
+    else if (_rateTimerArmed)
+    {
+        _idleRateTimer->cancelTimeout();
+        _rateTimerArmed = false;
+    }
+}
+
+void VoodooPS2TouchPadBase::onIdleRateTimer(void)
+{
+    _rateTimerArmed = false;
+    if (_rateIdle || !_fullRate || !idlerate || idlerate >= _fullRate || restartPending())
+        return;
+    
+    if (setReportRate(idlerate, true))
+    {
+        _rateIdle = true;
+        ++_idleRateSwitches;
+        setProperty("IdleRateSwitches", _idleRateSwitches, 32);
+        setProperty("IdlePackets", _idlePackets, 32);
+        setProperty("IdleRatePackets", _idleRatePackets, 32);
+    }
+}
+
+void VoodooPS2TouchPadBase::restoreReportRate(bool wait)
+{
+    if (_rateTimerArmed)
+    {
+        _idleRateTimer->cancelTimeout();
+        _rateTimerArmed = false;
+    }
+    if (!_rateIdle)
+        return;
+    
+    // the restart brings the device back at the full rate (see finishRecoveryStep)
+    if (restartPending())
+        return;
+    
+    if (!setReportRate(_fullRate, wait))
+        IOLog("%s: could not restore report rate %d\n", getName(), _fullRate);
+    _rateIdle = false;
+    setProperty("IdleRatePackets", _idleRatePackets, 32);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void VoodooPS2TouchPadBase::noteBadPacket()
+{
+    //
+    // Called for every packet that failed the framing checks.  A run of
+    // RecoveryBadPackets, or RecoveryWindowBadPackets within RecoveryWindow
+    // ms, schedules the next recovery step: resync the framing, then
+    // disable/enable streaming, then restart the device.  No step follows
+    // the previous one sooner than RecoveryBackoff ms, and that doubles with
+    // each restart, so a device that only ever sends garbage is not reset
+    // over and over.
+    //
+    
+    _goodSinceRecovery = 0;
+    if (!recoverybad || !_recoveryTimer || _recoveryPending)
+        return;
+    
+    uint64_t window;
+    nanoseconds_to_absolutetime((uint64_t)recoverywindow * 1000000, &window);
+    if (_frame->_packetTime - _badWindowStart > window)
+    {
+        _badWindowStart = _frame->_packetTime;
+        _badWindow = 0;
+    }
+    ++_badWindow;
+    ++_badConsecutive;
+    
+    if (_badConsecutive < (UInt32)recoverybad && (!recoverywindowbad || _badWindow < (UInt32)recoverywindowbad))
+        return;
+    if (_frame->_packetTime < _recoveryNext)
+        return;
+    
+    if (!_recoveryStart)
+        _recoveryStart = _frame->_packetTime;
+    if (_recoveryLevel < kRecoverRestart)
+        ++_recoveryLevel;
+    _recoveryPending = true;
+    _recoveryTimer->setTimeoutMS(1);
+}
+
+void VoodooPS2TouchPadBase::onRecoveryTimer(void)
+{
+    _recoveryPending = false;
+    int level = _recoveryLevel;
+    if (kRecoverNone == level)
+        return;
+    
+    if (kRecoverRestart == level)
+    {
+        //
+        // A restart is a full hw_init, as slow as the one in start, so it
+        // runs on a thread call under the device lock the same way (see
+        // initDevice).  No further step is taken until it is done.
+        //
+        
+        if (!_recoveryThreadCall)
+            return;
+        _recoveryPending = true;
+        retain();
+        if (thread_call_enter(_recoveryThreadCall))
+            release();  // already queued
+        return;
+    }
+    
+    finishRecoveryStep(level, recoverDevice(level));
+}
+
+void VoodooPS2TouchPadBase::restartCallout(thread_call_param_t param0, thread_call_param_t param1)
+{
+    VoodooPS2TouchPadBase* me = (VoodooPS2TouchPadBase*)param0;
+    assert(me);
+    
+    me->restartDevice();
+    
+    // drop the retain from onRecoveryTimer
+    me->release();
+}
+
+void VoodooPS2TouchPadBase::restartDevice()
+{
+    // see initDevice: stop() waits for us, or we see _initStopped
+    IOLockLock(_initLock);
+    if (!_initStopped)
+    {
+        _device->lock();
+        bool ok = recoverDevice(kRecoverRestart);
+        _device->unlock();
+        _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::finishRecoveryStep), (void*)kRecoverRestart, (void*)ok);
+    }
+    IOLockUnlock(_initLock);
+}
+
+void VoodooPS2TouchPadBase::finishRecoveryStep(int level, bool ok)
+{
+    static const char* const steps[] = { "resync", "stream reset", "restart" };
+    
+    if (kRecoverRestart == level)
+    {
+        // as initTouchPad: back at full rate, nothing held, and whatever
+        // arrived while hw_init ran is junk
+        _recoveryPending = false;
+        _frame->passbuttons = 0;
+        _frame->_clickbuttons = 0;
+        tracksecondary = false;
+        _rateIdle = false;
+        recoverDevice(kRecoverResync);
+    }
+    
+    ++_recoverySteps[level-1];
+    IOLog("%s: %s after bad packets (%d in a row, %d in window) %s\n", getName(), steps[level-1], _badConsecutive, _badWindow, ok ? "done" : "failed");
+    
+    // fresh evidence is needed for the next step, and not before the backoff
+    uint64_t now, backoff;
+    clock_get_uptime(&now);
+    nanoseconds_to_absolutetime((uint64_t)_recoveryBackoff * 1000000, &backoff);
+    _recoveryNext = now + backoff;
+    if (kRecoverRestart == level && _recoveryBackoff < 64 * (UInt32)recoverybackoff)
+        _recoveryBackoff *= 2;
+    _badConsecutive = 0;
+    _badWindow = 0;
+    _badWindowStart = now;
+    
+    if (_telemetry)
+        _telemetry->write(kPS2TS_Trackpad, kPS2TE_Recovery, level, now, ok);
+    setProperty("RecoveryResyncs", _recoverySteps[kRecoverResync-1], 32);
+    setProperty("RecoveryStreamResets", _recoverySteps[kRecoverStream-1], 32);
+    setProperty("RecoveryRestarts", _recoverySteps[kRecoverRestart-1], 32);
+}
+
+void VoodooPS2TouchPadBase::noteRecovered()
+{
+    //
+    // An episode is over once enough good packets arrive in a row after a
+    // step.  Time to recover is from the first bad packet acted on.
+    //
+    
+    if (_recoveryPending || ++_goodSinceRecovery < 2 * (UInt32)recoverybad)
+        return;
+    
+    uint64_t ns;
+    absolutetime_to_nanoseconds(_frame->_packetTime - _recoveryStart, &ns);
+    _recoveryTime = (UInt32)(ns / 1000);
+    if (_recoveryTime > _recoveryTimeMax)
+        _recoveryTimeMax = _recoveryTime;
+    DEBUG_LOG("%s: recovered at level %d after %d us\n", getName(), _recoveryLevel, _recoveryTime);
+    
+    _recoveryStart = 0;
+    _recoveryLevel = kRecoverNone;
+    _recoveryBackoff = recoverybackoff;
+    _goodSinceRecovery = 0;
+    
+    setProperty("RecoveryTime", _recoveryTime, 32);
+    setProperty("RecoveryTimeMax", _recoveryTimeMax, 32);
+}
+
+void VoodooPS2TouchPadBase::cancelRecovery()
+{
+    // going to sleep: wake starts over with a fresh init anyway
+    if (_recoveryTimer)
+        _recoveryTimer->cancelTimeout();
+    if (_recoveryThreadCall && thread_call_cancel(_recoveryThreadCall))
+        release();  // restartCallout never runs
+    _recoveryPending = false;
+    _recoveryStart = 0;
+    _recoveryLevel = kRecoverNone;
+    _recoveryBackoff = recoverybackoff;
+    _badConsecutive = _badWindow = _goodSinceRecovery = 0;
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
@@ -629,15 +1182,19 @@ void VoodooPS2TouchPadBase::initTouchPad()
     
     // clear passbuttons, just in case buttons were down when system
     // went to sleep (now just assume they are up)
-    passbuttons = 0;
-    _clickbuttons = 0;
+    _frame->passbuttons = 0;
+    _frame->_clickbuttons = 0;
     tracksecondary=false;
     
     // clear state of control key cache
     _modifierdown = 0;
     
-    // initialize the touchpad
+    // initialize the touchpad (at its full report rate), not in the
+    // middle of a restart (see restartDevice)
+    _rateIdle = false;
+    _device->lock();
     deviceSpecificInit();
+    _device->unlock();
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -647,111 +1204,130 @@ void VoodooPS2TouchPadBase::setParamPropertiesGated(OSDictionary * config)
 	if (NULL == config)
 		return;
     
+    //
+    // Build the new parameters from the last published ones.  This is not
+    // called on the workloop, and the packet path never looks at
+    // _paramsMaster, so the table walk below does not hold up input.
+    //
+    
+    IOLockLock(_paramsLock);
+    TouchPadParams& p = _paramsMaster;
+    
 	const struct {const char *name; int *var;} int32vars[]={
-		{"FingerZ",							&z_finger},
-		{"DivisorX",						&divisorx},
-		{"DivisorY",						&divisory},
-		{"EdgeRight",						&redge},
-		{"EdgeLeft",						&ledge},
-		{"EdgeTop",							&tedge},
-		{"EdgeBottom",						&bedge},
-		{"VerticalScrollDivisor",			&vscrolldivisor},
-		{"HorizontalScrollDivisor",			&hscrolldivisor},
-		{"CircularScrollDivisor",			&cscrolldivisor},
-		{"CenterX",							&centerx},
-		{"CenterY",							&centery},
-		{"CircularScrollTrigger",			&ctrigger},
-		{"MultiFingerWLimit",				&wlimit},
-		{"MultiFingerVerticalDivisor",		&wvdivisor},
-		{"MultiFingerHorizontalDivisor",	&whdivisor},
-        {"ZLimit",                          &zlimit},
-        {"MouseMultiplierX",                &mousemultiplierx},
-        {"MouseMultiplierY",                &mousemultipliery},
-        {"MouseScrollMultiplierX",          &mousescrollmultiplierx},
-        {"MouseScrollMultiplierY",          &mousescrollmultipliery},
-        {"WakeDelay",                       &wakedelay},
-        {"TapThresholdX",                   &tapthreshx},
-        {"TapThresholdY",                   &tapthreshy},
-        {"DoubleTapThresholdX",             &dblthreshx},
-        {"DoubleTapThresholdY",             &dblthreshy},
-        {"ZoneLeft",                        &zonel},
-        {"ZoneRight",                       &zoner},
-        {"ZoneTop",                         &zonet},
-        {"ZoneBottom",                      &zoneb},
-        {"DisableZoneLeft",                 &diszl},
-        {"DisableZoneRight",                &diszr},
-        {"DisableZoneTop",                  &diszt},
-        {"DisableZoneBottom",               &diszb},
-        {"DisableZoneControl",              &diszctrl},
-        {"Resolution",                      &_resolution},
-        {"ScrollResolution",                &_scrollresolution},
-        {"SwipeDeltaX",                     &swipedx},
-        {"SwipeDeltaY",                     &swipedy},
-        {"MouseCount",                      &mousecount},
-        {"RightClickZoneLeft",              &rczl},
-        {"RightClickZoneRight",             &rczr},
-        {"RightClickZoneTop",               &rczt},
-        {"RightClickZoneBottom",            &rczb},
-        {"HIDScrollZoomModifierMask",       &scrollzoommask},
-        {"ButtonCount",                     &_buttonCount},
-        {"DragLockTempMask",                &draglocktempmask},
-        {"MomentumScrollThreshY",           &momentumscrollthreshy},
-        {"MomentumScrollMultiplier",        &momentumscrollmultiplier},
-        {"MomentumScrollDivisor",           &momentumscrolldivisor},
-        {"MomentumScrollSamplesMin",        &momentumscrollsamplesmin},
-        {"FingerChangeIgnoreDeltas",        &ignoredeltasstart},
-        {"BogusDeltaThreshX",               &bogusdxthresh},
-        {"BogusDeltaThreshY",               &bogusdythresh},
-        {"UnitsPerMMX",                     &xupmm},
-        {"UnitsPerMMY",                     &yupmm},
-        {"ScrollDeltaThreshX",              &scrolldxthresh},
-        {"ScrollDeltaThreshY",              &scrolldythresh},
-        {"TrackpadThreeFingerVertSwipeGesture", &threefingervertswipe},
-        {"TrackpadThreeFingerHorizSwipeGesture", &threefingerhorizswipe},
+		{"FingerZ",							&p.z_finger},
+		{"DivisorX",						&p.divisorx},
+		{"DivisorY",						&p.divisory},
+		{"EdgeRight",						&p.redge},
+		{"EdgeLeft",						&p.ledge},
+		{"EdgeTop",							&p.tedge},
+		{"EdgeBottom",						&p.bedge},
+		{"VerticalScrollDivisor",			&p.vscrolldivisor},
+		{"HorizontalScrollDivisor",			&p.hscrolldivisor},
+		{"CircularScrollDivisor",			&p.cscrolldivisor},
+		{"CenterX",							&p.centerx},
+		{"CenterY",							&p.centery},
+		{"CircularScrollTrigger",			&p.ctrigger},
+		{"MultiFingerWLimit",				&p.wlimit},
+		{"MultiFingerVerticalDivisor",		&p.wvdivisor},
+		{"MultiFingerHorizontalDivisor",	&p.whdivisor},
+        {"ZLimit",                          &p.zlimit},
+        {"MouseMultiplierX",                &p.mousemultiplierx},
+        {"MouseMultiplierY",                &p.mousemultipliery},
+        {"MouseScrollMultiplierX",          &p.mousescrollmultiplierx},
+        {"MouseScrollMultiplierY",          &p.mousescrollmultipliery},
+        {"WakeDelay",                       &p.wakedelay},
+        {"IdleSampleRate",                  &p.idlerate},
+        {"IdleRateTimeout",                 &p.idleratetimeout},
+        {"RecoveryBadPackets",              &p.recoverybad},
+        {"RecoveryWindow",                  &p.recoverywindow},
+        {"RecoveryWindowBadPackets",        &p.recoverywindowbad},
+        {"RecoveryBackoff",                 &p.recoverybackoff},
+        {"PredictAhead",                    &p.predictahead},
+        {"TapThresholdX",                   &p.tapthreshx},
+        {"TapThresholdY",                   &p.tapthreshy},
+        {"DoubleTapThresholdX",             &p.dblthreshx},
+        {"DoubleTapThresholdY",             &p.dblthreshy},
+        {"ZoneLeft",                        &p.zonel},
+        {"ZoneRight",                       &p.zoner},
+        {"ZoneTop",                         &p.zonet},
+        {"ZoneBottom",                      &p.zoneb},
+        {"DisableZoneLeft",                 &p.diszl},
+        {"DisableZoneRight",                &p.diszr},
+        {"DisableZoneTop",                  &p.diszt},
+        {"DisableZoneBottom",               &p.diszb},
+        {"DisableZoneControl",              &p.diszctrl},
+        {"Resolution",                      &p._resolution},
+        {"ScrollResolution",                &p._scrollresolution},
+        {"ScrollSubdivision",               &p.scrollsubdiv},
+        {"SwipeDeltaX",                     &p.swipedx},
+        {"SwipeDeltaY",                     &p.swipedy},
+        {"MouseCount",                      &p.mousecount},
+        {"RightClickZoneLeft",              &p.rczl},
+        {"RightClickZoneRight",             &p.rczr},
+        {"RightClickZoneTop",               &p.rczt},
+        {"RightClickZoneBottom",            &p.rczb},
+        {"HIDScrollZoomModifierMask",       &p.scrollzoommask},
+        {"ButtonCount",                     &p._buttonCount},
+        {"DragLockTempMask",                &p.draglocktempmask},
+        {"MomentumScrollThreshY",           &p.momentumscrollthreshy},
+        {"MomentumScrollMultiplier",        &p.momentumscrollmultiplier},
+        {"MomentumScrollDivisor",           &p.momentumscrolldivisor},
+        {"MomentumScrollSamplesMin",        &p.momentumscrollsamplesmin},
+        {"FingerChangeIgnoreDeltas",        &p.ignoredeltasstart},
+        {"FingerChangeDebounce",            &p.fingerdebounce},
+        {"BogusDeltaThreshX",               &p.bogusdxthresh},
+        {"BogusDeltaThreshY",               &p.bogusdythresh},
+        {"UnitsPerMMX",                     &p.xupmm},
+        {"UnitsPerMMY",                     &p.yupmm},
+        {"ScrollDeltaThreshX",              &p.scrolldxthresh},
+        {"ScrollDeltaThreshY",              &p.scrolldythresh},
+        {"TrackpadThreeFingerVertSwipeGesture", &p.threefingervertswipe},
+        {"TrackpadThreeFingerHorizSwipeGesture", &p.threefingerhorizswipe},
 	};
 	const struct {const char *name; int *var;} boolvars[]={
-		{"StickyHorizontalScrolling",		&hsticky},
-		{"StickyVerticalScrolling",			&vsticky},
-		{"StickyMultiFingerScrolling",		&wsticky},
-		{"StabilizeTapping",				&tapstable},
-        {"DisableLEDUpdate",                &noled},
-        {"SmoothInput",                     &smoothinput},
-        {"UnsmoothInput",                   &unsmoothinput},
-        {"SkipPassThrough",                 &skippassthru},
-        {"SwapDoubleTriple",                &swapdoubletriple},
-        {"ClickPadTrackBoth",               &clickpadtrackboth},
-        {"ImmediateClick",                  &immediateclick},
-        {"MouseMiddleScroll",               &mousemiddlescroll},
-        {"FakeMiddleButton",                &_fakemiddlebutton},
+		{"StickyHorizontalScrolling",		&p.hsticky},
+		{"StickyVerticalScrolling",			&p.vsticky},
+		{"StickyMultiFingerScrolling",		&p.wsticky},
+		{"StabilizeTapping",				&p.tapstable},
+        {"DisableLEDUpdate",                &p.noled},
+        {"SmoothInput",                     &p.smoothinput},
+        {"UnsmoothInput",                   &p.unsmoothinput},
+        {"SkipPassThrough",                 &p.skippassthru},
+        {"SwapDoubleTriple",                &p.swapdoubletriple},
+        {"ClickPadTrackBoth",               &p.clickpadtrackboth},
+        {"ImmediateClick",                  &p.immediateclick},
+        {"MouseMiddleScroll",               &p.mousemiddlescroll},
+        {"FakeMiddleButton",                &p._fakemiddlebutton},
+        {"MiddleButtonImmediate",           &p._immediatemiddle},
+        {"FastSuspend",                     &p.fastsuspend},
 	};
     const struct {const char* name; bool* var;} lowbitvars[]={
-        {"Clicking",                        &clicking},
-        {"Dragging",                        &dragging},
-        {"TrackpadRightClick",              &rtap},
-        {"DragLock",                        &draglock},
-        {"TrackpadHorizScroll",             &hscroll},
-        {"TrackpadVertScroll",              &vscroll},
-        {"TrackpadScroll",                  &scroll},
-        {"OutsidezoneNoAction When Typing", &outzone_wt},
-        {"PalmNoAction Permanent",          &palm},
-        {"PalmNoAction When Typing",        &palm_wt},
-        {"USBMouseStopsTrackpad",           &usb_mouse_stops_trackpad},
-        {"TrackpadMomentumScroll",          &momentumscroll},
+        {"Clicking",                        &p.clicking},
+        {"Dragging",                        &p.dragging},
+        {"TrackpadRightClick",              &p.rtap},
+        {"DragLock",                        &p.draglock},
+        {"TrackpadHorizScroll",             &p.hscroll},
+        {"TrackpadVertScroll",              &p.vscroll},
+        {"TrackpadScroll",                  &p.scroll},
+        {"OutsidezoneNoAction When Typing", &p.outzone_wt},
+        {"PalmNoAction Permanent",          &p.palm},
+        {"PalmNoAction When Typing",        &p.palm_wt},
+        {"USBMouseStopsTrackpad",           &p.usb_mouse_stops_trackpad},
+        {"TrackpadMomentumScroll",          &p.momentumscroll},
     };
     const struct {const char* name; uint64_t* var; } int64vars[]={
-        {"MaxDragTime",                     &maxdragtime},
-        {"MaxTapTime",                      &maxtaptime},
-        {"HIDClickTime",                    &maxdbltaptime},
-        {"QuietTimeAfterTyping",            &maxaftertyping},
-        {"MomentumScrollTimer",             &momentumscrolltimer},
-        {"ClickPadClickTime",               &clickpadclicktime},
-        {"MiddleClickTime",                 &_maxmiddleclicktime},
-        {"DragExitDelayTime",               &dragexitdelay},
-        {"ScrollExitDelayTime",             &scrollexitdelay},
+        {"MaxDragTime",                     &p.maxdragtime},
+        {"MaxTapTime",                      &p.maxtaptime},
+        {"HIDClickTime",                    &p.maxdbltaptime},
+        {"QuietTimeAfterTyping",            &p.maxaftertyping},
+        {"MomentumScrollTimer",             &p.momentumscrolltimer},
+        {"ClickPadClickTime",               &p.clickpadclicktime},
+        {"MiddleClickTime",                 &p._maxmiddleclicktime},
+        {"DragExitDelayTime",               &p.dragexitdelay},
+        {"ScrollExitDelayTime",             &p.scrollexitdelay},
     };
     
-    int oldmousecount = mousecount;
-    bool old_usb_mouse_stops_trackpad = usb_mouse_stops_trackpad;
+    int oldmousecount = p.mousecount;
 
     OSBoolean *bl;
     OSNumber *num;
@@ -824,19 +1400,74 @@ void VoodooPS2TouchPadBase::setParamPropertiesGated(OSDictionary * config)
     //    maxdragtime = 230000000;
     
     // DivisorX and DivisorY cannot be zero, but don't crash if they are...
-    if (!divisorx)
-        divisorx = 1;
-    if (!divisory)
-        divisory = 1;
+    if (!p.divisorx)
+        p.divisorx = 1;
+    if (!p.divisory)
+        p.divisory = 1;
+
+    // scroll output in 1 (whole lines) to 1/16 lines
+    if (p.scrollsubdiv < 1)
+        p.scrollsubdiv = 1;
+    else if (p.scrollsubdiv > 16)
+        p.scrollsubdiv = 16;
 
     // bogusdeltathreshx/y = 0 is MAX_INT
-    if (!bogusdxthresh)
-        bogusdxthresh = 0x7FFFFFFF;
-    if (!bogusdythresh)
-        bogusdythresh = 0x7FFFFFFF;
+    if (!p.bogusdxthresh)
+        p.bogusdxthresh = 0x7FFFFFFF;
+    if (!p.bogusdythresh)
+        p.bogusdythresh = 0x7FFFFFFF;
+
+    //
+    // Publish a complete copy for the packet path.  If the previous one has
+    // not been picked up yet, it is simply replaced.
+    //
+    
+    TouchPadParams* params = (TouchPadParams*)IOMalloc(sizeof(TouchPadParams));
+    if (params)
+    {
+        *params = p;
+        params = exchangeParams(params);
+        if (params)
+            IOFree(params, sizeof(TouchPadParams));
+    }
+
+    // special terminating sequence from PS2Daemon is one-shot
+    if (-1 == p.mousecount)
+        p.mousecount = oldmousecount;
+    
+    IOLockUnlock(_paramsLock);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+TouchPadParams* VoodooPS2TouchPadBase::exchangeParams(TouchPadParams* params)
+{
+    TouchPadParams* old;
+    do
+    {
+        old = _pendingParams;
+    } while (!OSCompareAndSwapPtr(old, params, (void* volatile*)&_pendingParams));
+    return old;
+}
+
+void VoodooPS2TouchPadBase::adoptPendingParams()
+{
+    //
+    // Called on the workloop between packets: swap in the most recently
+    // published parameters as a whole.
+    //
+    
+    TouchPadParams* params = exchangeParams(NULL);
+    if (!params)
+        return;
+    
+    int oldmousecount = mousecount;
+    bool old_usb_mouse_stops_trackpad = usb_mouse_stops_trackpad;
+    *static_cast<TouchPadParams*>(this) = *params;
+    IOFree(params, sizeof(TouchPadParams));
 
 //REVIEW: this should be done maybe only when necessary...
-    touchmode=MODE_NOTOUCH;
+    _frame->touchmode=MODE_NOTOUCH;
 
     // check for special terminating sequence from PS2Daemon
     if (-1 == mousecount)
@@ -851,9 +1482,62 @@ void VoodooPS2TouchPadBase::setParamPropertiesGated(OSDictionary * config)
     if ((oldmousecount != 0) != (mousecount != 0) || old_usb_mouse_stops_trackpad != usb_mouse_stops_trackpad)
     {
         // either last mouse removed or first mouse added
-        ignoreall = (mousecount != 0) && usb_mouse_stops_trackpad;
+        _frame->ignoreall = (mousecount != 0) && usb_mouse_stops_trackpad;
         touchpadToggled();
     }
+
+    buildZoneMap();
+}
+
+void VoodooPS2TouchPadBase::buildZoneMap()
+{
+    //
+    // Every zone is a rectangle, so membership is the AND of an x range and
+    // a y range.  Each axis gets a table with one bit per zone, and
+    // classifyZone is then two lookups and an AND for any contact, with the
+    // same results as comparing against the individual edges.  Coordinates
+    // outside the tables (negative, or scaled up past kZoneMapSize) are
+    // classified by the same comparisons at packet time.
+    //
+    
+    for (int i = 0; i < kZoneMapSize; i++)
+    {
+        _zonex[i] = zoneBitsX(i);
+        _zoney[i] = zoneBitsY(i);
+    }
+}
+
+UInt8 VoodooPS2TouchPadBase::zoneBitsX(int x)
+{
+    // edge zones only depend on one axis
+    UInt8 bits = kZoneTopEdge | kZoneBottomEdge;
+    if (x < ledge)
+        bits |= kZoneLeftEdge;
+    if (x > redge)
+        bits |= kZoneRightEdge;
+    if (x > diszl && x < diszr)
+        bits |= kZoneDisable;
+    if (x > rczl && x < rczr)
+        bits |= kZoneRightClick;
+    if (x >= zonel && x <= zoner)
+        bits |= kZoneTyping;
+    return bits;
+}
+
+UInt8 VoodooPS2TouchPadBase::zoneBitsY(int y)
+{
+    UInt8 bits = kZoneLeftEdge | kZoneRightEdge;
+    if (y > tedge)
+        bits |= kZoneTopEdge;
+    if (y < bedge)
+        bits |= kZoneBottomEdge;
+    if (y > diszb && y < diszt)
+        bits |= kZoneDisable;
+    if (y > rczb && y < rczt)
+        bits |= kZoneRightClick;
+    if (y >= zoneb && y <= zonet)
+        bits |= kZoneTyping;
+    return bits;
 }
 
 IOReturn VoodooPS2TouchPadBase::setParamProperties(OSDictionary* dict)
@@ -861,9 +1545,11 @@ IOReturn VoodooPS2TouchPadBase::setParamProperties(OSDictionary* dict)
     ////IOReturn result = super::IOHIDevice::setParamProperties(dict);
     if (_cmdGate)
     {
-        // syncronize through workloop...
-        ////_cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VooodooPS2TouchPadBase::setParamPropertiesGated), dict);
+        // parameters are built here and published as a snapshot, then
+        // adopted on the workloop right away (also applies mouse count
+        // changes when the pad is idle)...
         setParamPropertiesGated(dict);
+        _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::adoptPendingParams));
     }
     
     return super::setParamProperties(dict);
@@ -875,8 +1561,33 @@ IOReturn VoodooPS2TouchPadBase::setProperties(OSObject *props)
 	OSDictionary *dict = OSDynamicCast(OSDictionary, props);
     if (dict && _cmdGate)
     {
-        // syncronize through workloop...
-        _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::setParamPropertiesGated), dict);
+        // published as a snapshot, see setParamProperties
+        setParamPropertiesGated(dict);
+        _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::adoptPendingParams));
+        
+        // format the hot path event log into the registry (EventLog, EventLogCounts)
+        if (dict->getObject("EventLog"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::publishEventLog));
+        
+        // packet type counters and decode time samples (DecodeStats)
+        if (dict->getObject("DecodeStats"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::publishDecodeStats));
+        
+        // decoder throughput over a synthetic stream (DecodeBench)
+        if (dict->getObject("DecodeBench"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::runDecodeBench));
+        
+        // decoder round trip against the encoder (DecodeCheck)
+        if (dict->getObject("DecodeCheck"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::runDecodeCheck));
+        
+        // emitted and suppressed HID events (OutputEvents, OutputSuppressed)
+        if (dict->getObject("OutputStats"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::publishOutputStats));
+        
+        // how well motion prediction is doing (PredictSamples, PredictError, PredictBaselineError)
+        if (dict->getObject("PredictStats"))
+            _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &VoodooPS2TouchPadBase::publishPredictStats));
     }
     
 	return super::setProperties(props);
@@ -884,29 +1595,99 @@ IOReturn VoodooPS2TouchPadBase::setProperties(OSObject *props)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void VoodooPS2TouchPadBase::publishEventLog()
+{
+    _eventLog.publish(this);
+}
+
+void VoodooPS2TouchPadBase::publishOutputStats()
+{
+    setProperty("OutputEvents", _eventsEmitted, 32);
+    setProperty("OutputSuppressed", _eventsSuppressed, 32);
+}
+
+void VoodooPS2TouchPadBase::publishPredictStats()
+{
+    // mean error per sample in trackpad units, with and without prediction
+    UInt32 samples = _frame->x_pred.samples() + _frame->y_pred.samples();
+    setProperty("PredictSamples", samples, 32);
+    if (samples)
+    {
+        setProperty("PredictError", (UInt32)((_frame->x_pred.errorSum() + _frame->y_pred.errorSum()) / samples), 32);
+        setProperty("PredictBaselineError", (UInt32)((_frame->x_pred.baselineSum() + _frame->y_pred.baselineSum()) / samples), 32);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void VoodooPS2TouchPadBase::setDevicePowerState( UInt32 whatToDo )
 {
     switch ( whatToDo )
     {
         case kPS2C_DisableDevice:
+        {
             //
             // Disable touchpad (synchronous).
             //
 
+            uint64_t start, now;
+            clock_get_uptime(&start);
+
+            // go to sleep at the full rate, so wake starts from known state;
+            // a restart already running on its thread call is waited for
+            cancelRecovery();
+            _device->lock();
+            restoreReportRate(true);
             setTouchPadEnable( false );
+            _device->unlock();
+
+            // suspend latency telemetry
+            clock_get_uptime(&now);
+            absolutetime_to_nanoseconds(now - start, &now);
+            setProperty("SuspendTime", (UInt32)(now / 1000), 32);
             break;
+        }
 
         case kPS2C_EnableDevice:
+        {
             //
             // Must not issue any commands before the device has
-            // completed its power-on self-test and calibration.
+            // completed its power-on self-test and calibration.  WakeDelay
+            // is the upper bound, but we go on as soon as the device has
+            // reported BAT completion or answers commands again.
             //
 
-            IOSleep(wakedelay);
+            uint64_t start, now;
+            clock_get_uptime(&start);
+            
+            TPS2Request<1> request;
+            request.commands[0].command = kPS2C_WaitMouseReady;
+            request.commands[0].inOrOut32 = wakedelay;
+            request.commandsCount = 1;
+            assert(request.commandsCount <= countof(request.commands));
+            _device->submitRequestAndBlock(&request);
+            if (1 != request.commandsCount)
+                IOLog("%s: device not ready after %d ms, initializing anyway\n", getName(), wakedelay);
+            // either way, nothing set up before sleep can be relied on
+            _wakeReset = 1 != request.commandsCount || (request.commands[0].inOrOut32 & kPS2C_MouseReadyBAT);
+            
+            clock_get_uptime(&now);
+            absolutetime_to_nanoseconds(now - start, &now);
+            _wakeReadyTime = (UInt32)(now / 1000);
+            if (_wakeReadyTime > _wakeReadyTimeMax)
+                _wakeReadyTimeMax = _wakeReadyTime;
             
             // Reset and enable the touchpad.
             initTouchPad();
+            
+            // resume latency telemetry
+            clock_get_uptime(&now);
+            absolutetime_to_nanoseconds(now - start, &now);
+            setProperty("WakeReadyTime", _wakeReadyTime, 32);
+            setProperty("WakeReadyTimeMax", _wakeReadyTimeMax, 32);
+            setProperty("ResumeTime", (UInt32)(now / 1000), 32);
             break;
+        }
     }
 }
 
@@ -929,7 +1710,7 @@ void VoodooPS2TouchPadBase::receiveMessage(int message, void* data)
         case kPS2M_getDisableTouchpad:
         {
             bool* pResult = (bool*)data;
-            *pResult = !ignoreall;
+            *pResult = !_frame->ignoreall;
             break;
         }
             
@@ -937,10 +1718,10 @@ void VoodooPS2TouchPadBase::receiveMessage(int message, void* data)
         {
             bool enable = *((bool*)data);
             // ignoreall is true when trackpad has been disabled
-            if (enable == ignoreall)
+            if (enable == _frame->ignoreall)
             {
                 // save state, and update LED
-                ignoreall = !enable;
+                _frame->ignoreall = !enable;
                 touchpadToggled();
             }
             break;
@@ -1015,12 +1796,12 @@ void VoodooPS2TouchPadBase::receiveMessage(int message, void* data)
                         break;
                     }
                     _modifierdown &= ~masks[pInfo->adbKeyCode-0x36];
-                    keytime = pInfo->time;
+                    _frame->keytime = pInfo->time;
                     break;
                     
                 default:
-                    momentumscrollcurrent = 0;  // keys cancel momentum scroll
-                    keytime = pInfo->time;
+                    _frame->momentumscrollcurrent = 0;  // keys cancel momentum scroll
+                    _frame->keytime = pInfo->time;
             }
             break;
         }
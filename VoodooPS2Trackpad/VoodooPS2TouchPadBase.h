@@ -9,30 +9,22 @@
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/hidsystem/IOHIPointing.h>
 #include <IOKit/IOCommandGate.h>
+#include <IOKit/IOLocks.h>
+#include <kern/thread_call.h>
 #include "Decay.h"
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// VoodooPS2TouchPadBase Class Declaration
+// TouchPadParams Declaration
+//
+// All of the tunables that come from the Platform Profile or the prefs pane.
+// Writers never modify the copy the packet path is using.  Instead they build
+// a complete new block and publish it with a single pointer swap, and the
+// packet path adopts it between packets (see setParamPropertiesGated and
+// adoptParams).  This way a packet never sees a half-applied update.
 //
 
-#define kPacketLength 6
-
-class EXPORT VoodooPS2TouchPadBase : public IOHIPointing
+struct TouchPadParams
 {
-    typedef IOHIPointing super;
-    OSDeclareAbstractStructors(VoodooPS2TouchPadBase);
-
-protected:
-    ApplePS2MouseDevice * _device;
-    bool                _interruptHandlerInstalled;
-    bool                _powerControlHandlerInstalled;
-    bool                _messageHandlerInstalled;
-    RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
-    UInt32              _packetByteCount;
-    UInt8               _lastdata;
-    UInt16              _touchPadVersion;
-
-    IOCommandGate*      _cmdGate;
     int z_finger;
 	int divisorx, divisory;
 	int ledge;
@@ -53,7 +45,6 @@ protected:
     int threefingervertswipe;
     int threefingerhorizswipe;
 	bool draglock;
-    int draglocktemp;
 	bool hscroll, vscroll, scroll;
 	bool rtap;
     bool outzone_wt, palm, palm_wt;
@@ -64,6 +55,10 @@ protected:
     int mousescrollmultiplierx, mousescrollmultipliery;
     int mousemiddlescroll;
     int wakedelay;
+    int fastsuspend;
+    int idlerate, idleratetimeout;
+    int recoverybad, recoverywindow, recoverywindowbad, recoverybackoff;
+    int predictahead;
     int smoothinput;
     int unsmoothinput;
     int skippassthru;
@@ -73,6 +68,7 @@ protected:
     int diszl, diszr, diszt, diszb;
     int diszctrl; // 0=automatic (ledpresent), 1=enable always, -1=disable always
     int _resolution, _scrollresolution;
+    int scrollsubdiv;
     int swipedx, swipedy;
     int _buttonCount;
     int swapdoubletriple;
@@ -80,18 +76,78 @@ protected:
     uint64_t clickpadclicktime;
     int clickpadtrackboth;
     int ignoredeltasstart;
+    int fingerdebounce;
     int bogusdxthresh, bogusdythresh;
     int scrolldxthresh, scrolldythresh;
     int immediateclick;
+    int rczl, rczr, rczb, rczt; // rightclick zone for 1-button ClickPads
+    int mousecount;
+    bool usb_mouse_stops_trackpad;
+    int scrollzoommask;
+
+    // for scaling x/y values
+    int xupmm, yupmm;
 
-    // three finger and four finger state
-    uint8_t inSwipeLeft, inSwipeRight;
-    uint8_t inSwipeUp, inSwipeDown;
-    uint8_t inSwipe4Left, inSwipe4Right;
-    uint8_t inSwipe4Up, inSwipe4Down;
-    int xmoved, ymoved;
+    // middle button simulation
+    uint64_t _maxmiddleclicktime;
+    int _fakemiddlebutton;
+    int _immediatemiddle;
 
-    int rczl, rczr, rczb, rczt; // rightclick zone for 1-button ClickPads
+    // momentum scroll
+    bool momentumscroll;
+    uint64_t momentumscrolltimer;
+    int momentumscrollthreshy;
+    int momentumscrollmultiplier;
+    int momentumscrolldivisor;
+    int momentumscrollsamplesmin;
+
+    // drag/scroll exit delays
+    uint64_t dragexitdelay;
+    uint64_t scrollexitdelay;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// VoodooPS2TouchPadBase Class Declaration
+//
+
+#define kPacketLength (8+8+8) // 8 bytes for packet data (V4 is the largest), 1 byte kind, 7 not used, 8 bytes for timestamp
+#define kPacketKindOffset 8
+#define kPacketTimeOffset 16
+
+class EXPORT VoodooPS2TouchPadBase : public IOHIPointing, protected TouchPadParams
+{
+    typedef IOHIPointing super;
+    OSDeclareAbstractStructors(VoodooPS2TouchPadBase);
+
+protected:
+    ApplePS2MouseDevice * _device;
+    bool                _interruptHandlerInstalled;
+    bool                _powerControlHandlerInstalled;
+    bool                _messageHandlerInstalled;
+    RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
+    UInt32              _packetByteCount;
+    PS2EventLog<64>     _eventLog;      // hot path logging, sites set by subclass
+    PS2TelemetryRing*   _telemetry;     // shared with the controller, NULL if not available
+    UInt8               _lastdata;
+    UInt16              _touchPadVersion;
+
+    IOCommandGate*      _cmdGate;
+
+    // configuration snapshots (see TouchPadParams)
+    IOLock*             _paramsLock;
+    TouchPadParams      _paramsMaster;
+    TouchPadParams* volatile _pendingParams;
+
+    // resume latency (us)
+    UInt32              _wakeReadyTime;
+    UInt32              _wakeReadyTimeMax;
+    bool                _wakeReset;     // BAT seen, or not ready, on the last wake
+
+    // background device bring-up (see start)
+    thread_call_t       _initThreadCall;
+    IOLock*             _initLock;
+    bool                _initStopped;
+    uint64_t            _startTime;
 
     // state related to secondary packets/extendedwmode
     int lastx2, lasty2;
@@ -100,21 +156,9 @@ protected:
     bool clickedprimary;
     bool _extendedwmode;
 
-    // normal state
-	int lastx, lasty, last_fingers, b4last;
-    UInt32 lastbuttons;
+    // normal state (the per-packet part is in TouchPadFrame below)
+    int b4last;
     UInt32 lastTrackStickButtons, lastTouchpadButtons;
-    int ignoredeltas;
-    int ignoresingle;
-	int xrest, yrest, scrollrest;
-    int touchx, touchy;
-	uint64_t touchtime;
-	uint64_t untouchtime;
-	bool wasdouble,wastriple;
-    bool scrolldebounce;
-    uint64_t keytime;
-    bool ignoreall;
-    UInt32 passbuttons;
 #ifdef SIMULATE_PASSTHRU
     UInt32 trackbuttons;
 #endif
@@ -122,15 +166,8 @@ protected:
     bool ledpresent;
     bool _reportsv;
     int clickpadtype;   //0=not, 1=1button, 2=2button, 3=reserved
-    UInt32 _clickbuttons;  //clickbuttons to merge into buttons
-    int mousecount;
-    bool usb_mouse_stops_trackpad;
 
     int _modifierdown; // state of left+right control keys
-    int scrollzoommask;
-
-    // for scaling x/y values
-    int xupmm, yupmm;
 
     // for middle button simulation
     enum mbuttonstate
@@ -138,47 +175,51 @@ protected:
         STATE_NOBUTTONS,
         STATE_MIDDLE,
         STATE_WAIT4TWO,
+        STATE_PASS4TWO,     // like STATE_WAIT4TWO, but the button is already delivered
         STATE_WAIT4NONE,
         STATE_NOOP,
-    } _mbuttonstate;
+    };
 
-    UInt32 _pendingbuttons;
-    uint64_t _buttontime;
+    UInt32 _middleImmediate, _middleConversions;
+    uint64_t _middleLatencySaved;   // ns the held single presses would have waited
     IOTimerEventSource* _buttonTimer;
-    uint64_t _maxmiddleclicktime;
-    int _fakemiddlebutton;
 
-    // momentum scroll state
-    bool momentumscroll;
-    bool wasScroll = false;
-    SimpleAverage<int, 32> dy_history;
-    SimpleAverage<uint64_t, 32> time_history;
+    // output stage counters (see dispatchRelativePointerEventX)
+    UInt32 _eventsEmitted, _eventsSuppressed;
+
+    // momentum scroll (the state is in TouchPadFrame)
     IOTimerEventSource* scrollTimer;
-    uint64_t momentumscrolltimer;
-    int momentumscrollthreshy;
-    uint64_t momentumscrollinterval;
-    int momentumscrollsum;
-    int64_t momentumscrollcurrent;
-    int64_t momentumscrollrest1;
-    int momentumscrollmultiplier;
-    int momentumscrolldivisor;
-    int momentumscrollrest2;
-    int momentumscrollsamplesmin;
 
     // timer for drag delay
-    uint64_t dragexitdelay;
-    uint64_t scrollexitdelay;
     IOTimerEventSource* dragTimer;
     
     IOTimerEventSource* scrollDebounceTIMER;
     
-    SimpleAverage<int, 5> x_avg;
-    SimpleAverage<int, 5> y_avg;
-    //DecayingAverage<int, int64_t, 1, 1, 2> x_avg;
-    //DecayingAverage<int, int64_t, 1, 1, 2> y_avg;
-    UndecayAverage<int, int64_t, 1, 1, 2> x_undo;
-    UndecayAverage<int, int64_t, 1, 1, 2> y_undo;
-
+    // adaptive report rate (see updateReportRate)
+    int _fullRate;                  // set by deviceSpecificInit, 0 if not supported
+    bool _rateIdle;
+    bool _rateTimerArmed;
+    IOTimerEventSource* _idleRateTimer;
+    UInt32 _idlePackets;            // no contact, but at full rate
+    UInt32 _idleRatePackets;        // delivered at idle rate
+    UInt32 _idleRateSwitches;
+    
+    // bad packet recovery (see noteBadPacket)
+    enum { kRecoverNone, kRecoverResync, kRecoverStream, kRecoverRestart };
+    int _recoveryLevel;             // last step taken in the current episode
+    bool _recoveryPending;          // step scheduled on _recoveryTimer
+    IOTimerEventSource* _recoveryTimer;
+    thread_call_t       _recoveryThreadCall;    // restart step (see restartCallout)
+    UInt32 _badConsecutive;
+    UInt32 _badWindow;              // bad packets since _badWindowStart
+    uint64_t _badWindowStart;
+    UInt32 _goodSinceRecovery;
+    uint64_t _recoveryStart;        // first bad packet acted on, 0 if no episode
+    uint64_t _recoveryNext;         // no further step before this
+    UInt32 _recoveryBackoff;        // ms, doubles with each restart
+    UInt32 _recoverySteps[kRecoverRestart];
+    UInt32 _recoveryTime, _recoveryTimeMax;   // us
+    
     SimpleAverage<int, 5> x2_avg;
     SimpleAverage<int, 5> y2_avg;
     //DecayingAverage<int, int64_t, 1, 1, 2> x2_avg;
@@ -186,7 +227,7 @@ protected:
     UndecayAverage<int, int64_t, 1, 1, 2> x2_undo;
     UndecayAverage<int, int64_t, 1, 1, 2> y2_undo;
 
-	enum
+	enum TouchMode
     {
         // "no touch" modes... must be even (see isTouchMode)
         MODE_NOTOUCH =      0,
@@ -207,19 +248,113 @@ protected:
         MODE_WAIT1RELEASE = 101,    // "touch"
         MODE_WAIT2TAP =     102,    // "no touch"
         MODE_WAIT2RELEASE = 103,    // "touch"
-    } touchmode;
-
-    inline bool isTouchMode() { return touchmode & 1; }
+    };
+
+    //
+    // Everything dispatchEventsWithInfo reads or writes for a packet, in
+    // one block of its own (see init) that starts on a cache line, apart
+    // from configuration (TouchPadParams) and from the timers, counters
+    // and Synaptics secondary state that only matter off the common path.
+    // The fields every packet touches come first; the gesture progress
+    // after them is only touched by some.  The block is zeroed rather
+    // than constructed, which is the reset state of the filters in
+    // Decay.h, so keep to members for which that holds.  DecodeBench
+    // runs the dispatch over a scratch block (see _benchRunning).
+    //
+    struct TouchPadFrame
+    {
+        uint64_t _packetTime;   // arrival of the packet being processed
+        uint64_t touchtime;
+        uint64_t keytime;
+        TouchMode touchmode;
+        int lastx, lasty, last_fingers;
+        int xrest, yrest, scrollrest;
+        int touchx, touchy;
+        int ignoredeltas;
+        int ignoresingle;
+        int _fingersStable, _fingersCandidate, _fingersPending, _debounceZ;  // see debounceFingers
+        bool _fingersCarried;
+        int _scrollUnits;   // scroll events are in 1/_scrollUnits lines (ScrollSubdivision, fixed at start)
+        mbuttonstate _mbuttonstate;
+        UInt32 lastbuttons;
+        UInt32 passbuttons;
+        UInt32 _clickbuttons;   // clickbuttons to merge into buttons
+        UInt32 _emittedButtons; // see dispatchRelativePointerEventX
+        UInt32 _pendingbuttons;
+        uint64_t _buttontime;
+        bool wasdouble, wastriple;
+        bool scrolldebounce;
+        bool ignoreall;
+        bool wasScroll;
+        int draglocktemp;
+        SimpleAverage<int, 5> x_avg;
+        SimpleAverage<int, 5> y_avg;
+        //DecayingAverage<int, int64_t, 1, 1, 2> x_avg;
+        //DecayingAverage<int, int64_t, 1, 1, 2> y_avg;
+        UndecayAverage<int, int64_t, 1, 1, 2> x_undo;
+        UndecayAverage<int, int64_t, 1, 1, 2> y_undo;
+        MotionPredictor x_pred;
+        MotionPredictor y_pred;
+
+        // three finger and four finger swipes
+        uint8_t inSwipeLeft, inSwipeRight;
+        uint8_t inSwipeUp, inSwipeDown;
+        uint8_t inSwipe4Left, inSwipe4Right;
+        uint8_t inSwipe4Up, inSwipe4Down;
+        int xmoved, ymoved;
+
+        // momentum scroll
+        uint64_t untouchtime;
+        SimpleAverage<int, 32> dy_history;
+        SimpleAverage<uint64_t, 32> time_history;
+        uint64_t momentumscrollinterval;
+        int momentumscrollsum;
+        int64_t momentumscrollcurrent;
+        int64_t momentumscrollrest1;
+        int momentumscrollrest2;
+    };
+    enum { kFrameAlign = 64 };
+    static inline size_t frameSize()
+        { return (sizeof(TouchPadFrame) + kFrameAlign - 1) & ~(size_t)(kFrameAlign - 1); }
+    TouchPadFrame* _frame;
+    bool _benchRunning;     // dispatch has no effect outside _frame (see runDecodeBench)
+
+    inline bool isTouchMode() { return _frame->touchmode & 1; }
+
+    // zone classification (see buildZoneMap)
+    enum
+    {
+        kZoneLeftEdge =     0x01,
+        kZoneRightEdge =    0x02,
+        kZoneTopEdge =      0x04,
+        kZoneBottomEdge =   0x08,
+        kZoneDisable =      0x10,
+        kZoneRightClick =   0x20,
+        kZoneTyping =       0x40,   // inside ZoneLeft/Right/Top/Bottom
+    };
+    enum { kZoneMapSize = 8192 };   // coordinates beyond are compared directly
+    UInt8 _zonex[kZoneMapSize];
+    UInt8 _zoney[kZoneMapSize];
+
+    void buildZoneMap();
+    UInt8 zoneBitsX(int x);
+    UInt8 zoneBitsY(int y);
+    inline UInt8 classifyZone(int x, int y)
+    {
+        UInt8 xbits = (unsigned)x < kZoneMapSize ? _zonex[x] : zoneBitsX(x);
+        UInt8 ybits = (unsigned)y < kZoneMapSize ? _zoney[y] : zoneBitsY(y);
+        return xbits & ybits;
+    }
 
     inline bool isInDisableZone(int x, int y)
-        { return x > diszl && x < diszr && y > diszb && y < diszt; }
+        { return classifyZone(x, y) & kZoneDisable; }
 
     // Sony: coordinates captured from single touch event
     // Don't know what is the exact value of x and y on edge of touchpad
     // the best would be { return x > xmax/2 && y < ymax/4; }
 
     inline bool isInRightClickZone(int x, int y)
-        { return x > rczl && x < rczr && y > rczb && y < rczt; }
+        { return classifyZone(x, y) & kZoneRightClick; }
 
     virtual void   setTouchPadEnable( bool enable ) = 0;
 	virtual PS2InterruptResult interruptOccurred(UInt8 data) = 0;
@@ -236,28 +371,108 @@ protected:
 
     void onScrollTimer(void);
     void onScrollDebounceTimer(void);
+    int debounceFingers(int fingers, int z);
     void onButtonTimer(void);
     void onDragTimer(void);
+    void onIdleRateTimer(void);
+    void onRecoveryTimer(void);
+    static void restartCallout(thread_call_param_t param0, thread_call_param_t param1);
+    void restartDevice();
+    void finishRecoveryStep(int level, bool ok);
+
+    virtual bool setReportRate(int rate, bool wait) { return false; }
+    void updateReportRate(bool active);
+    void restoreReportRate(bool wait);
+
+    // kRecoverRestart runs on a thread call with the device locked, the
+    // other levels on the workloop (see restartDevice)
+    virtual bool recoverDevice(int level) { return false; }
+    inline bool restartPending() const
+        { return _recoveryPending && kRecoverRestart == _recoveryLevel; }
+    void noteBadPacket();
+    void noteRecovered();
+    void cancelRecovery();
+    inline void noteGoodPacket()
+        { _badConsecutive = 0; if (_recoveryStart) noteRecovered(); }
 
     enum MBComingFrom { fromPassthru, fromTimer, fromTrackpad, fromCancel };
     UInt32 middleButton(UInt32 buttons, uint64_t now, MBComingFrom from);
 
+    static void initCallout(thread_call_param_t param0, thread_call_param_t param1);
+    void initDevice(ApplePS2MouseDevice* device);
+
     virtual void setParamPropertiesGated(OSDictionary* dict);
+    TouchPadParams* exchangeParams(TouchPadParams* params);
+    void adoptPendingParams();
+    void publishEventLog();
+    virtual void publishDecodeStats() {}
+    virtual void runDecodeBench() {}
+    virtual void runDecodeCheck() {}
+    void publishOutputStats();
+    void publishPredictStats();
+    inline void adoptParams()
+        { if (_pendingParams) adoptPendingParams(); }
 
 	virtual IOItemCount buttonCount();
 	virtual IOFixed     resolution();
     virtual bool deviceSpecificInit() = 0;
+    // all pointer and scroll output goes through these; events without
+    // motion or a button change carry nothing new and are only counted
+    // (sub-unit motion stays in xrest/yrest/scrollrest until it adds up)
     inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
-        { dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now); }
+    {
+        if (_benchRunning)
+            return;
+        if (!dx && !dy && buttonState == _frame->_emittedButtons)
+            { ++_eventsSuppressed; return; }
+        ++_eventsEmitted;
+        _frame->_emittedButtons = buttonState;
+        dispatchRelativePointerEvent(dx, dy, buttonState, *(AbsoluteTime*)&now);
+    }
+    inline short scrollLines(int lines) { return (short)(lines * _frame->_scrollUnits); }
     inline void dispatchScrollWheelEventX(short deltaAxis1, short deltaAxis2, short deltaAxis3, uint64_t now)
-        { dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now); }
+    {
+        if (_benchRunning)
+            return;
+        if (!deltaAxis1 && !deltaAxis2 && !deltaAxis3)
+            { ++_eventsSuppressed; return; }
+        ++_eventsEmitted;
+        dispatchScrollWheelEvent(deltaAxis1, deltaAxis2, deltaAxis3, *(AbsoluteTime*)&now);
+    }
+    inline void dispatchKeyboardMessageX(int message, uint64_t* now)
+        { if (!_benchRunning) _device->dispatchKeyboardMessage(message, now); }
+    inline void telemetry(UInt8 event, UInt16 code, SInt32 a0 = 0, SInt32 a1 = 0, SInt32 a2 = 0, SInt32 a3 = 0)
+        { if (_telemetry && !_benchRunning) _telemetry->write(kPS2TS_Trackpad, event, code, _frame->_packetTime, a0, a1, a2, a3); }
+    inline void telemetryDispatch(UInt16 code, SInt32 dx, SInt32 dy)
+    {
+        // stamped at dispatch, with the time since the packet arrived
+        if (_telemetry && _telemetry->enabled() && !_benchRunning) {
+            uint64_t now;
+            clock_get_uptime(&now);
+            _telemetry->write(kPS2TS_Trackpad, kPS2TE_Dispatch, code, now, dx, dy, 0, (SInt32)(now - _frame->_packetTime));
+        }
+    }
+    enum
+    {
+        kPacketNative = 0,      // device protocol packet
+        kPacketBad,             // failed framing checks, dropped
+        kPacketRelative,        // bare 3-byte PS/2 packet (passthrough)
+    };
+    inline void queuePacket(UInt8* packet, UInt8 kind = kPacketNative)
+    {
+        // mark packet with kind and timestamp, the workloop may get to it much later
+        packet[kPacketKindOffset] = kind;
+        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+        _ringBuffer.advanceHead(kPacketLength);
+    }
     inline void setTimerTimeout(IOTimerEventSource* timer, uint64_t time)
-        { timer->setTimeout(*(AbsoluteTime*)&time); }
+        { if (!_benchRunning) timer->setTimeout(*(AbsoluteTime*)&time); }
     inline void cancelTimer(IOTimerEventSource* timer)
-        { timer->cancelTimeout(); }
+        { if (!_benchRunning) timer->cancelTimeout(); }
 
 public:
     virtual bool init( OSDictionary * properties );
+    virtual void free();
     virtual VoodooPS2TouchPadBase * probe( IOService * provider,
                                                SInt32 *    score ) = 0;
     virtual bool start( IOService * provider );
@@ -21,6 +21,7 @@
  */
 
 #include "alps.h"
+#include "alps_encoder.h"
 
 enum {
     kTapEnabled = 0x01
@@ -168,6 +169,9 @@ ALPS *ALPS::probe(IOService *provider, SInt32 *score) {
     
     _device = (ApplePS2MouseDevice *) provider;
     
+    uint64_t start, now;
+    clock_get_uptime(&start);
+    
     _device->lock();
     resetMouse();
     
@@ -179,6 +183,11 @@ ALPS *ALPS::probe(IOService *provider, SInt32 *score) {
     }
     _device->unlock();
     
+    // boot timing: reset + identify (hw_init is timed separately, see start)
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - start, &now);
+    setProperty("BootProbeTime", (UInt32)(now / 1000), 32);
+    
     _device = 0;
     
     return success ? this : 0;
@@ -202,7 +211,41 @@ bool ALPS::deviceSpecificInit() {
     
     // Setup expected packet size
     priv.pktsize = priv.proto_version == ALPS_PROTO_V4 ? 8 : 6;
+
+    if (_suspendedFast) {
+        //
+        // Woke from a fast suspend: if the device did not go through its
+        // power-on self-test (no BAT, see setDevicePowerState) and still
+        // reports the same status, it kept its mode, and all it needs is
+        // reporting turned back on.  The status alone is no proof, it can
+        // be the power-on default (V4 hw_init ends at rate 0x64).  Anything
+        // else means it lost power or was reset, so do the full reset and
+        // hw_init that the slow suspend would have.
+        //
+
+        _suspendedFast = false;
+
+        ALPSStatus_t status;
+        if (!_wakeReset && alps_get_status(&status) && !memcmp(&status, &_suspendStatus, sizeof(status))) {
+            TPS2Request<1> request;
+            request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+            request.commands[0].inOrOut = kDP_Enable;
+            request.commandsCount = 1;
+            assert(request.commandsCount <= countof(request.commands));
+            _device->submitRequestAndBlock(&request);
+            if (1 == request.commandsCount) {
+                DEBUG_LOG("ALPS: fast resume\n");
+                return true;
+            }
+        }
+
+        IOLog("ALPS: device state lost over sleep, doing full init\n");
+        resetMouse();
+    }
     
+    // hw_init sets this if the protocol runs at a plain sample rate
+    _fullRate = 0;
+
     if (!(this->*hw_init)()) {
         goto init_fail;
     }
@@ -217,6 +260,41 @@ init_fail:
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+// hot path log sites, in the order of the kLog enum
+static const PS2EventLogSite logSites[] =
+{
+    { "ALPS: invalid packet dropped (%02x %02x %02x %02x)", 10 },
+    { "ALPS: rejected trackstick packet from non DualPoint device (proto %x)", 2 },
+};
+
+// DecodeStats keys, in kStat order
+static const char* const decodeStatNames[] =
+{
+    "V1V2",
+    "Position",
+    "Bitmap",
+    "MPRestart",
+    "MPOrphan",
+    "BitmapEmpty",
+    "V3Stick",
+    "V4Packets",
+    "V4Complete",
+    "V6Touchpad",
+    "V6Stick",
+    "V7Idle",
+    "V7Two",
+    "V7Multi",
+    "V7New",
+    "V7Unknown",
+    "V7Stick",
+    "SS4Idle",
+    "SS4One",
+    "SS4Two",
+    "SS4Multi",
+    "SS4Stick",
+    "SS4Orphan",
+};
+
 /* Link with Base Driver */
 bool ALPS::init(OSDictionary *dict) {
     if (!super::init(dict)) {
@@ -224,12 +302,23 @@ bool ALPS::init(OSDictionary *dict) {
     }
     
     // Intialize Variables
-    lastx=0;
-    lasty=0;
-    last_fingers=0;
-    xrest=0;
-    yrest=0;
-    lastbuttons=0;
+    _frame->lastx=0;
+    _frame->lasty=0;
+    _frame->last_fingers=0;
+    _frame->xrest=0;
+    _frame->yrest=0;
+    _frame->lastbuttons=0;
+    _suspendedFast=false;
+    _packetIdle=false;
+    _contactKept=false;
+    _resyncPending=false;
+    _reportTimeoutMS=0;
+    _eventLog.init(logSites, countof(logSites));
+    bzero(_decodeStats, sizeof(_decodeStats));
+    _decodePackets=0;
+    _decodeSamples=0;
+    _decodeTime=0;
+    _decodeTimeMax=0;
     
     // Default Configuration
     clicking=true;
@@ -285,7 +374,8 @@ void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
     int back = 0, forward = 0;
     uint64_t now_abs;
     
-    clock_get_uptime(&now_abs);
+    now_abs = _frame->_packetTime;
+    ++_decodeStats[kStatV1V2];
     
     if (priv.proto_version == ALPS_PROTO_V1) {
         left = packet[2] & 0x10;
@@ -352,7 +442,7 @@ void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
      * sequence Z>0, Z==0, Z>0, so the Z==0 event has to be generated manually.
      */
     if (ges && fin && !priv.prev_fin) {
-        touchmode = MODE_DRAG;
+        _frame->touchmode = MODE_DRAG;
     }
     priv.prev_fin = fin;
     
@@ -369,7 +459,7 @@ void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
     if (priv.flags & ALPS_WHEEL) {
         int scrollAmount = ((packet[2] << 1) & 0x08) - ((packet[0] >> 4) & 0x07);
         if (scrollAmount) {
-            dispatchScrollWheelEventX(scrollAmount, 0, 0, now_abs);
+            dispatchScrollWheelEventX(scrollLines(scrollAmount), 0, 0, now_abs);
         }
     }
 }
@@ -534,6 +624,55 @@ int ALPS::alps_process_bitmap(struct alps_data *priv,
   return fingers;
 }
 
+/*
+ * Follow a contact with a constant velocity prediction. A position
+ * within gate of the prediction continues the contact and returns true,
+ * anything else starts a new contact with a new id.
+ */
+bool ALPS::alps_track_contact(struct alps_data *priv, struct alps_contact *c,
+                              int x, int y, int gate)
+{
+    if (c->id) {
+        int dx = x - (c->x + c->vx);
+        int dy = y - (c->y + c->vy);
+        
+        if (abs(dx) <= gate && abs(dy) <= gate) {
+            /* half of the last step, so bitmap quantization doesn't dominate */
+            c->vx = (c->vx + x - c->x) / 2;
+            c->vy = (c->vy + y - c->y) / 2;
+            c->x = x;
+            c->y = y;
+            return true;
+        }
+    }
+    
+    if (++priv->contact_id <= 0)
+        priv->contact_id = 1;
+    c->id = priv->contact_id;
+    c->x = x;
+    c->y = y;
+    c->vx = 0;
+    c->vy = 0;
+    return false;
+}
+
+/*
+ * Track the primary (st) contact of a semi-MT frame, gated by one bitmap
+ * cell. When it continues through a finger change, the deltas don't
+ * need to be ignored (see dispatchEventsWithInfo).
+ */
+void ALPS::alps_track_primary(int x, int y, int fingers)
+{
+    if (!fingers) {
+        priv.contact.id = 0;
+        _contactKept = false;
+        return;
+    }
+    
+    int gate = max(priv.x_max / (priv.x_bits - 1), priv.y_max / (priv.y_bits - 1));
+    _contactKept = alps_track_contact(&priv, &priv.contact, x, y, gate);
+}
+
 void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     int x, y, z, left, right, middle;
     uint64_t now_abs;
@@ -577,7 +716,7 @@ void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     /* To get proper movement direction */
     y = -y;
     
-    clock_get_uptime(&now_abs);
+    now_abs = _frame->_packetTime;
     
     /*
      * Most ALPS models report the trackstick buttons in the touchpad
@@ -603,17 +742,17 @@ void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     
     /* Button status can appear in normal packet */
     if (0 == raw_buttons) {
-        buttons = lastbuttons;
+        buttons = _frame->lastbuttons;
     } else {
         buttons = raw_buttons;
-        lastbuttons = buttons;
+        _frame->lastbuttons = buttons;
     }
     
     /* If middle button is pressed, switch to scroll mode. Else, move pointer normally */
     if (0 == (buttons & 0x04)) {
         dispatchRelativePointerEventX(x, y, buttons, now_abs);
     } else {
-        dispatchScrollWheelEventX(-y, -x, 0, now_abs);
+        dispatchScrollWheelEventX(scrollLines(-y), scrollLines(-x), 0, now_abs);
     }
 }
 
@@ -717,6 +856,8 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
     memset(&f, 0, sizeof(f));
     
     (this->*decode_fields)(&f, packet);
+    if (!f.is_mp)
+        ++_decodeStats[kStatPosition];
     /*
      * There's no single feature of touchpad position and bitmap packets
      * that can be used to distinguish between them. We rely on the fact
@@ -731,6 +872,7 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
          * position packet as usual.
          */
         if (f.is_mp) {
+            ++_decodeStats[kStatBitmap];
             fingers = f.fingers;
             /*
              * Bitmap processing uses position packet's coordinate
@@ -738,9 +880,11 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
              */
             (this->*decode_fields)(&f, priv.multi_data);
             if (alps_process_bitmap(&priv, &f) == 0) {
+                ++_decodeStats[kStatBitmapEmpty];
                 fingers = 0; /* Use st data */
             }
         } else {
+            ++_decodeStats[kStatMPRestart];
             priv.multi_packet = 0;
         }
     }
@@ -754,6 +898,7 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
      * bit set.
      */
     if (f.is_mp) {
+        ++_decodeStats[kStatMPOrphan];
         return;
     }
     
@@ -783,6 +928,8 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
         priv.second_touch = -1;
     }
     
+    alps_track_primary(f.mt[0].x, f.mt[0].y, fingers);
+    
     buttons |= f.left ? 0x01 : 0;
     buttons |= f.right ? 0x02 : 0;
     buttons |= f.middle ? 0x04 : 0;
@@ -799,7 +946,7 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
     f.mt[1].y = priv.y_max - f.mt[1].y;
     
     /* Ignore 1 finger events after 2 finger scroll to prevent jitter */
-    if (last_fingers == 2 && fingers == 1 && scrolldebounce) {
+    if (_frame->last_fingers == 2 && fingers == 1 && _frame->scrolldebounce) {
         //fingers = 2;
     }
     
@@ -816,6 +963,7 @@ void ALPS::alps_process_packet_v3(UInt8 *packet) {
      * of packets.
      */
     if (packet[5] == 0x3f) {
+        ++_decodeStats[kStatV3Stick];
         alps_process_trackstick_packet_v3(packet);
         return;
     }
@@ -829,8 +977,7 @@ void ALPS::alps_process_packet_v6(UInt8 *packet)
     int fingers = 0;
     int buttons = 0;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _frame->_packetTime;
     
     /*
      * We can use Byte5 to distinguish if the packet is from Touchpad
@@ -839,6 +986,7 @@ void ALPS::alps_process_packet_v6(UInt8 *packet)
      * Trackpoint:	0x7F
      */
     if (packet[5] == 0x7F) {
+        ++_decodeStats[kStatV6Stick];
         /* It should be a DualPoint when received Trackpoint packet */
         if (!(priv.flags & ALPS_DUALPOINT)) {
             return;
@@ -866,6 +1014,7 @@ void ALPS::alps_process_packet_v6(UInt8 *packet)
     }
     
     /* Touchpad packet */
+    ++_decodeStats[kStatV6Touchpad];
     x = packet[1] | ((packet[3] & 0x78) << 4);
     y = packet[2] | ((packet[4] & 0x78) << 4);
     z = packet[5];
@@ -891,6 +1040,7 @@ void ALPS::alps_process_packet_v4(UInt8 *packet) {
      * broken up between 3 normal packets. Use priv.multi_packet to
      * track our position in the bitmap packet.
      */
+    ++_decodeStats[kStatV4Packets];
     if (packet[6] & 0x40) {
         /* sync, reset position */
         priv.multi_packet = 0;
@@ -914,6 +1064,7 @@ void ALPS::alps_process_packet_v4(UInt8 *packet) {
     
     if (++priv.multi_packet > 2) {
         priv.multi_packet = 0;
+        ++_decodeStats[kStatV4Complete];
         
         f.x_map = ((priv.multi_data[2] & 0x1f) << 10) |
         ((priv.multi_data[3] & 0x60) << 3) |
@@ -924,7 +1075,12 @@ void ALPS::alps_process_packet_v4(UInt8 *packet) {
         (priv.multi_data[1] & 0x1f);
         
         fingers = alps_process_bitmap(&priv, &f);
+        if (!fingers)
+            ++_decodeStats[kStatBitmapEmpty];
+        if (fingers < 2)
+            priv.second_touch = -1;
         
+        alps_track_primary(f.st.x, f.st.y, fingers ? fingers : f.pressure > 0);
     }
     
     buttons |= f.left ? 0x01 : 0;
@@ -1013,6 +1169,7 @@ bool ALPS::alps_decode_packet_v7(struct alps_fields *f, UInt8 *p){
     unsigned char pkt_id;
     
     pkt_id = alps_get_packet_id_v7(p);
+    ++_decodeStats[kStatV7Idle + pkt_id];
     if (pkt_id == V7_PACKET_ID_IDLE)
         return true;
     if (pkt_id == V7_PACKET_ID_UNKNOWN)
@@ -1072,12 +1229,12 @@ void ALPS::alps_process_trackstick_packet_v7(UInt8 *packet)
     int x, y, z, left, right, middle;
     int buttons = 0;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _frame->_packetTime;
   
     /* It should be a DualPoint when received trackstick packet */
     if (!(priv.flags & ALPS_DUALPOINT)) {
-        IOLog("ALPS: Rejected trackstick packet from non DualPoint device");
+        _eventLog.log(kLogTrackstickRejected, priv.proto_version);
+        telemetry(kPS2TE_Drop, kPS2TD_NonDualPoint, packet[0], packet[1], packet[2], priv.proto_version);
         return;
     }
     
@@ -1104,7 +1261,7 @@ void ALPS::alps_process_trackstick_packet_v7(UInt8 *packet)
     if (0 == (buttons & 0x04)) {
         dispatchRelativePointerEventX(x, y, buttons, now_abs);
     } else {
-        dispatchScrollWheelEventX(-y, -x, 0, now_abs);
+        dispatchScrollWheelEventX(scrollLines(-y), scrollLines(-x), 0, now_abs);
     }
 }
 
@@ -1144,9 +1301,10 @@ void ALPS::alps_process_touchpad_packet_v7(UInt8 *packet){
 }
 
 void ALPS::alps_process_packet_v7(UInt8 *packet){
-    if (packet[0] == 0x48 && (packet[4] & 0x47) == 0x06)
+    if (packet[0] == 0x48 && (packet[4] & 0x47) == 0x06) {
+        ++_decodeStats[kStatV7Stick];
         alps_process_trackstick_packet_v7(packet);
-    else
+    } else
         alps_process_touchpad_packet_v7(packet);
 }
 
@@ -1186,8 +1344,7 @@ bool ALPS::alps_decode_ss4_v2(struct alps_fields *f, UInt8 *p){
     //struct alps_data *priv;
     unsigned char pkt_id;
     unsigned int no_data_x, no_data_y;
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _frame->_packetTime;
     
     pkt_id = alps_get_pkt_id_ss4_v2(p);
     
@@ -1301,8 +1458,9 @@ void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
     struct alps_fields f;
     int x, y, pressure;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _frame->_packetTime;
+    unsigned char pkt_id = alps_get_pkt_id_ss4_v2(packet);
+    ++_decodeStats[kStatSS4Idle + pkt_id];
     
     memset(&f, 0, sizeof(struct alps_fields));
     (this->*decode_fields)(&f, packet);
@@ -1326,6 +1484,7 @@ void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
      * When it is set, it means 2nd packet comes without 1st packet come.
      */
     if (f.is_mp) {
+        ++_decodeStats[kStatSS4Orphan];
         return;
     }
     
@@ -1339,9 +1498,10 @@ void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
     priv.multi_packet = 0;
     
     /* Report trackstick */
-    if (alps_get_pkt_id_ss4_v2(packet) == SS4_PACKET_ID_STICK) {
+    if (pkt_id == SS4_PACKET_ID_STICK) {
         if (!(priv.flags & ALPS_DUALPOINT)) {
-            IOLog("ALPS: Rejected trackstick packet from non DualPoint device\n");
+            _eventLog.log(kLogTrackstickRejected, priv.proto_version);
+            telemetry(kPS2TE_Drop, kPS2TD_NonDualPoint, packet[0], packet[1], packet[2], priv.proto_version);
             return;
         }
         
@@ -1386,10 +1546,25 @@ void ALPS::setTouchPadEnable(bool enable) {
     
     if (enable) {
         initTouchPad();
-    } else {
-        // to disable just reset the mouse
-        resetMouse();
+        return;
     }
+
+    //
+    // Fast suspend: reading the status report (F5 F5 F5 E9) leaves the
+    // device with reporting disabled, and the report itself is what
+    // deviceSpecificInit compares against on wake.  If the device kept
+    // its state across sleep we can skip reset and hw_init there.
+    //
+
+    _suspendedFast = false;
+    if (fastsuspend && alps_get_status(&_suspendStatus)) {
+        DEBUG_LOG("ALPS: fast suspend, status %02x %02x %02x\n", _suspendStatus.bytes[0], _suspendStatus.bytes[1], _suspendStatus.bytes[2]);
+        _suspendedFast = true;
+        return;
+    }
+
+    // to disable just reset the mouse
+    resetMouse();
 }
 
 PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
@@ -1398,14 +1573,23 @@ PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
     // events need to be delivered. Process the trackpad data. Do NOT issue
     // any BLOCKING commands to our device in this context.
     //
+    // Framing follows Linux alps_process_byte: the byte is stored first and
+    // the checks look at the packet so far.  Every packet that leaves here,
+    // good or bad, restarts framing at the next byte.
+    //
     
     UInt8 *packet = _ringBuffer.head();
     
-    /* Save first packet */
-    if (0 == _packetByteCount) {
-        packet[0] = data;
+    // resync (see recoverDevice): drop everything up to a valid first byte
+    if (_resyncPending) {
+        _packetByteCount = 0;
+        if ((data & priv.mask0) != priv.byte0)
+            return kPS2IR_packetBuffering;
+        _resyncPending = false;
     }
     
+    packet[_packetByteCount++] = data;
+    
     /* Reset PSMOUSE_BAD_DATA flag */
     priv.PSMOUSE_BAD_DATA = false;
     
@@ -1418,38 +1602,30 @@ PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
      */
     if (priv.proto_version != ALPS_PROTO_V8 &&
         (packet[0] & 0xc8) == 0x08) {
-        if (_packetByteCount == 3) {
-            //dispatchRelativePointerEventWithPacket(packet, kPacketLengthSmall); //Dr Hurt: allow this?
-            priv.PSMOUSE_BAD_DATA = true;
-            _ringBuffer.advanceHead(priv.pktsize);
+        if (_packetByteCount == kPacketLengthSmall) {
+            queuePacket(packet, kPacketRelative);
+            _packetByteCount = 0;
             return kPS2IR_packetReady;
         }
-        packet[_packetByteCount++] = data;
         return kPS2IR_packetBuffering;
     }
     
     /* Check for PS/2 packet stuffed in the middle of ALPS packet. */
     if ((priv.flags & ALPS_PS2_INTERLEAVED) &&
         _packetByteCount >= 4 && (packet[3] & 0x0f) == 0x0f) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
+        return alps_handle_interleaved_ps2(packet);
     }
     
     /* alps_is_valid_first_byte */
     if ((packet[0] & priv.mask0) != priv.byte0) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
+        goto bad_data;
     }
     
     /* Bytes 2 - pktsize should have 0 in the highest bit */
     if (priv.proto_version < ALPS_PROTO_V5 &&
         _packetByteCount >= 2 && _packetByteCount <= priv.pktsize &&
         (packet[_packetByteCount - 1] & 0x80)) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
+        goto bad_data;
     }
     
     /* alps_is_valid_package_v7 */
@@ -1457,41 +1633,140 @@ PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
         (((_packetByteCount == 3) && ((packet[2] & 0x40) != 0x40)) ||
          ((_packetByteCount == 4) && ((packet[3] & 0x48) != 0x48)) ||
          ((_packetByteCount == 6) && ((packet[5] & 0x40) != 0x0)))) {
-            priv.PSMOUSE_BAD_DATA = true;
-            _ringBuffer.advanceHead(priv.pktsize);
-            return kPS2IR_packetReady;
-        }
+        goto bad_data;
+    }
     
     /* alps_is_valid_package_ss4_v2 */
     if (priv.proto_version == ALPS_PROTO_V8 &&
         ((_packetByteCount == 4 && ((packet[3] & 0x08) != 0x08)) ||
          (_packetByteCount == 6 && ((packet[5] & 0x10) != 0x0)))) {
-            priv.PSMOUSE_BAD_DATA = true;
-            _ringBuffer.advanceHead(priv.pktsize);
-            return kPS2IR_packetReady;
-        }
+        goto bad_data;
+    }
     
-    packet[_packetByteCount++] = data;
     if (_packetByteCount == priv.pktsize)
     {
-        _ringBuffer.advanceHead(priv.pktsize);
+        queuePacket(packet);
+        _packetByteCount = 0;
         return kPS2IR_packetReady;
     }
     return kPS2IR_packetBuffering;
+    
+bad_data:
+    priv.PSMOUSE_BAD_DATA = true;
+    queuePacket(packet, kPacketBad);
+    _packetByteCount = 0;
+    return kPS2IR_packetReady;
+}
+
+PS2InterruptResult ALPS::alps_handle_interleaved_ps2(UInt8 *packet) {
+    //
+    // V2 DualPoints may send a 3-byte PS/2 packet in the middle of a 6-byte
+    // ALPS packet (as bytes 3-5).  Which one it was is only known once the
+    // byte after the ALPS packet arrives.  Linux also flushes a lone final
+    // packet with a 20ms timer; here it waits for the next byte instead.
+    //
+    
+    if (_packetByteCount <= 6) {
+        return kPS2IR_packetBuffering;
+    }
+    
+    if (packet[6] & 0x80) {
+        /*
+         * Highest bit is set - that means we either had complete
+         * ALPS packet and this is start of the next packet or we
+         * got garbage.
+         */
+        if (((packet[3] | packet[4] | packet[5]) & 0x80) ||
+            (packet[6] & priv.mask0) != priv.byte0) {
+            priv.PSMOUSE_BAD_DATA = true;
+            queuePacket(packet, kPacketBad);
+            _packetByteCount = 0;
+            return kPS2IR_packetReady;
+        }
+        
+        UInt8 next = packet[6];
+        queuePacket(packet);
+        
+        /* Continue with the next packet */
+        packet = _ringBuffer.head();
+        packet[0] = next;
+        _packetByteCount = 1;
+    } else {
+        /*
+         * High bit is 0 - that means that we indeed got a PS/2
+         * packet in the middle of ALPS packet.
+         */
+        UInt8 alps[3] = { packet[0], packet[1], packet[2] };
+        UInt8 next = packet[6];
+        packet[0] = packet[3];
+        packet[1] = packet[4];
+        packet[2] = packet[5];
+        queuePacket(packet, kPacketRelative);
+        
+        /*
+         * Continue with the standard ALPS protocol handling,
+         * but make sure we won't process it as an interleaved
+         * packet again, which may happen if all buttons are
+         * pressed. To avoid this let's reset the 4th bit which
+         * is normally 1.
+         */
+        packet = _ringBuffer.head();
+        packet[0] = alps[0];
+        packet[1] = alps[1];
+        packet[2] = alps[2];
+        packet[3] = next & 0xf7;
+        _packetByteCount = 4;
+    }
+    return kPS2IR_packetReady;
 }
 
 void ALPS::packetReady() {
+    // pick up new configuration between packets, never in the middle of one
+    adoptParams();
+    
     // empty the ring buffer, dispatching each packet...
-    while (_ringBuffer.count() >= priv.pktsize) {
+    while (_ringBuffer.count() >= kPacketLength) {
         UInt8 *packet = _ringBuffer.tail();
-        if (priv.PSMOUSE_BAD_DATA == false) {
-            (this->*process_packet)(packet);
-        } else {
-            IOLog("ALPS: an invalid or bare packet has been dropped...\n");
-            /* Might need to perform a full HW reset here if we keep receiving bad packets (consecutively) */
+        _frame->_packetTime = *(uint64_t*)(&packet[kPacketTimeOffset]);
+        telemetry(kPS2TE_Packet, packet[kPacketKindOffset], packet[0], packet[1], packet[2], packet[3]);
+        switch (packet[kPacketKindOffset]) {
+            case kPacketNative:
+                noteGoodPacket();
+                _packetIdle = false;
+                if (++_decodePackets & (kDecodeSampleInterval - 1)) {
+                    (this->*process_packet)(packet);
+                } else {
+                    // time one packet in kDecodeSampleInterval, decode through dispatch
+                    uint64_t start, end;
+                    clock_get_uptime(&start);
+                    (this->*process_packet)(packet);
+                    clock_get_uptime(&end);
+                    end -= start;
+                    ++_decodeSamples;
+                    _decodeTime += end;
+                    if (end > _decodeTimeMax)
+                        _decodeTimeMax = end;
+                }
+                updateReportRate(!_packetIdle);
+                break;
+                
+            case kPacketRelative:
+                noteGoodPacket();
+                if (!skippassthru) {
+                    dispatchRelativePointerEventWithPacket(packet, kPacketLengthSmall);
+                    updateReportRate(true);
+                } else {
+                    telemetry(kPS2TE_Drop, kPS2TD_Passthrough, packet[0], packet[1], packet[2]);
+                }
+                break;
+                
+            default:
+                _eventLog.log(kLogBadPacket, packet[0], packet[1], packet[2], packet[3]);
+                telemetry(kPS2TE_Drop, kPS2TD_BadPacket, packet[0], packet[1], packet[2], packet[3]);
+                noteBadPacket();
+                break;
         }
-        _packetByteCount = 0;
-        _ringBuffer.advanceTail(priv.pktsize);
+        _ringBuffer.advanceTail(kPacketLength);
     }
 }
 
@@ -1564,7 +1839,7 @@ bool ALPS::alps_command_mode_set_addr(int addr) {
 }
 
 int ALPS::alps_command_mode_read_reg(int addr) {
-    TPS2Request<4> request;
+    UInt8 commands[] = { kDP_GetMouseInformation }; //sync..
     ALPSStatus_t status;
     
     if (!alps_command_mode_set_addr(addr)) {
@@ -1572,26 +1847,10 @@ int ALPS::alps_command_mode_read_reg(int addr) {
         return -1;
     }
     
-    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut = kDP_GetMouseInformation; //sync..
-    request.commands[1].command = kPS2C_ReadDataPort;
-    request.commands[1].inOrOut = 0;
-    request.commands[2].command = kPS2C_ReadDataPort;
-    request.commands[2].inOrOut = 0;
-    request.commands[3].command = kPS2C_ReadDataPort;
-    request.commands[3].inOrOut = 0;
-    request.commandsCount = 4;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
-    
-    if (request.commandsCount != 4) {
+    if (!alps_command_report(commands, countof(commands), &status)) {
         return -1;
     }
     
-    status.bytes[0] = request.commands[1].inOrOut;
-    status.bytes[1] = request.commands[2].inOrOut;
-    status.bytes[2] = request.commands[3].inOrOut;
-    
     //IOLog("ALPS read reg result: { 0x%02x, 0x%02x, 0x%02x }\n", status.bytes[0], status.bytes[1], status.bytes[2]);
     
     /* The address being read is returned in the first 2 bytes
@@ -1627,43 +1886,24 @@ bool ALPS::alps_command_mode_write_reg(UInt8 value) {
 }
 
 bool ALPS::alps_rpt_cmd(SInt32 init_command, SInt32 init_arg, SInt32 repeated_command, ALPSStatus_t *report) {
-    TPS2Request<9> request;
-    int byte0, cmd;
-    cmd = byte0 = 0;
+    UInt8 commands[6];
+    int cmd = 0;
     
     if (init_command) {
-        request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[cmd++].inOrOut = kDP_SetMouseResolution;
-        request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[cmd++].inOrOut = init_arg;
+        commands[cmd++] = kDP_SetMouseResolution;
+        commands[cmd++] = init_arg;
     }
     
-    
     // 3X run command
-    request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmd++].inOrOut = repeated_command;
-    request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmd++].inOrOut = repeated_command;
-    request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmd++].inOrOut = repeated_command;
+    commands[cmd++] = repeated_command;
+    commands[cmd++] = repeated_command;
+    commands[cmd++] = repeated_command;
     
     // Get info/result
-    request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-    byte0 = cmd;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commandsCount = cmd;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
+    commands[cmd++] = kDP_GetMouseInformation;
+    assert(cmd <= (int)countof(commands));
     
-    report->bytes[0] = request.commands[byte0].inOrOut;
-    report->bytes[1] = request.commands[byte0+1].inOrOut;
-    report->bytes[2] = request.commands[byte0+2].inOrOut;
+    bool result = alps_command_report(commands, cmd, report);
     
     DEBUG_LOG("%02x report: [0x%02x 0x%02x 0x%02x]\n",
               repeated_command,
@@ -1671,7 +1911,35 @@ bool ALPS::alps_rpt_cmd(SInt32 init_command, SInt32 init_arg, SInt32 repeated_co
               report->bytes[1],
               report->bytes[2]);
     
-    return request.commandsCount == cmd;
+    return result;
+}
+
+bool ALPS::alps_command_report(UInt8 *commands, int count, ALPSStatus_t *report) {
+    //
+    // Sends the commands (the last one being the one that reports, usually
+    // kDP_GetMouseInformation) and reads its 3 byte answer, all as two bulk
+    // steps of a single request.  _reportTimeoutMS, if set, is the read
+    // budget for both (see identify).
+    //
+    
+    TPS2Request<3> request;
+    int cmdCount = 0;
+    report->bytes[0] = report->bytes[1] = report->bytes[2] = 0;
+    if (_reportTimeoutMS) {
+        request.commands[cmdCount].command = kPS2C_SetReadTimeout;
+        request.commands[cmdCount++].inOrOut32 = _reportTimeoutMS;
+    }
+    request.commands[cmdCount].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[cmdCount].buffer = commands;
+    request.commands[cmdCount++].count = count;
+    request.commands[cmdCount].command = kPS2C_ReadMouseDataPortBytes;
+    request.commands[cmdCount].buffer = report->bytes;
+    request.commands[cmdCount++].count = sizeof(report->bytes);
+    request.commandsCount = cmdCount;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    
+    return request.commandsCount == cmdCount;
 }
 
 bool ALPS::alps_enter_command_mode() {
@@ -1700,22 +1968,18 @@ bool ALPS::alps_exit_command_mode() {
 }
 
 bool ALPS::alps_passthrough_mode_v2(bool enable) {
-    int cmd = enable ? kDP_SetMouseScaling2To1 : kDP_SetMouseScaling1To1;
-    TPS2Request<4> request;
+    UInt8 cmd = enable ? kDP_SetMouseScaling2To1 : kDP_SetMouseScaling1To1;
+    UInt8 commands[] = { cmd, cmd, cmd, kDP_SetDefaultsAndDisable };
+    TPS2Request<1> request;
     
-    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut = cmd;
-    request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[1].inOrOut = cmd;
-    request.commands[2].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[2].inOrOut = cmd;
-    request.commands[3].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[3].inOrOut = kDP_SetDefaultsAndDisable;
-    request.commandsCount = 4;
+    request.commands[0].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[0].buffer = commands;
+    request.commands[0].count = countof(commands);
+    request.commandsCount = 1;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
     
-    return request.commandsCount == 4;
+    return request.commandsCount == 1;
 }
 
 bool ALPS::alps_absolute_mode_v1_v2() {
@@ -1760,23 +2024,15 @@ int ALPS::alps_monitor_mode_write_reg(int addr, int value)
 
 int ALPS::alps_monitor_mode(bool enable)
 {
-    TPS2Request<4> request;
-    int cmd = 0;
+    ALPSStatus_t status;
+    
+    UInt8 info[] = { kDP_GetMouseInformation };
     
+    // the knocks are fire and forget: a NAK on one of them does not stop
+    // the rest, only the reports are read in bulk
     if (enable) {
-        
         ps2_command_short(kDP_MouseResetWrap);
-        request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commandsCount = cmd;
-        assert(request.commandsCount <= countof(request.commands));
-        _device->submitRequestAndBlock(&request);
+        alps_command_report(info, countof(info), &status);
         
         ps2_command_short(kDP_SetDefaultsAndDisable);
         ps2_command_short(kDP_SetDefaultsAndDisable);
@@ -1785,17 +2041,7 @@ int ALPS::alps_monitor_mode(bool enable)
         ps2_command_short(kDP_SetMouseScaling2To1);
         
         /* Get Info */
-        request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commands[cmd].command = kPS2C_ReadDataPort;
-        request.commands[cmd++].inOrOut = 0;
-        request.commandsCount = cmd;
-        assert(request.commandsCount <= countof(request.commands));
-        _device->submitRequestAndBlock(&request);
+        alps_command_report(info, countof(info), &status);
     } else {
         ps2_command_short(kDP_MouseResetWrap);
     }
@@ -1825,31 +2071,27 @@ bool ALPS::alps_get_status(ALPSStatus_t *status) {
  * we don't fiddle with it.
  */
 bool ALPS::alps_tap_mode(bool enable) {
-    int cmd = enable ? kDP_SetMouseSampleRate : kDP_SetMouseResolution;
+    UInt8 cmd = enable ? kDP_SetMouseSampleRate : kDP_SetMouseResolution;
     UInt8 tapArg = enable ? 0x0A : 0x00;
-    TPS2Request<8> request;
+    UInt8 info[] = { kDP_GetMouseInformation };
+    UInt8 commands[] = { kDP_SetDefaultsAndDisable, kDP_SetDefaultsAndDisable, cmd, tapArg };
+    TPS2Request<3> request;
     ALPSStatus_t result;
     
-    request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[0].inOrOut = kDP_GetMouseInformation;
-    request.commands[1].command = kPS2C_ReadDataPort;
-    request.commands[1].inOrOut = 0;
-    request.commands[2].command = kPS2C_ReadDataPort;
-    request.commands[2].inOrOut = 0;
-    request.commands[3].command = kPS2C_ReadDataPort;
-    request.commands[3].inOrOut = 0;
-    request.commands[4].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[4].inOrOut = kDP_SetDefaultsAndDisable;
-    request.commands[5].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[5].inOrOut = kDP_SetDefaultsAndDisable;
-    request.commands[6].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[6].inOrOut = cmd;
-    request.commands[7].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[7].inOrOut = tapArg;
-    request.commandsCount = 8;
+    request.commands[0].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[0].buffer = info;
+    request.commands[0].count = countof(info);
+    request.commands[1].command = kPS2C_ReadMouseDataPortBytes;
+    request.commands[1].buffer = result.bytes;
+    request.commands[1].count = sizeof(result.bytes);
+    request.commands[2].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[2].buffer = commands;
+    request.commands[2].count = countof(commands);
+    request.commandsCount = 3;
+    assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
     
-    if (request.commandsCount != 8) {
+    if (request.commandsCount != 3) {
         DEBUG_LOG("Enabling tap mode failed before getStatus call, command count=%d\n",
                   request.commandsCount);
         return false;
@@ -1985,7 +2227,8 @@ error:
 IOReturn ALPS::alps_setup_trackstick_v3(int regBase) {
     IOReturn ret = 0;
     ALPSStatus_t report;
-    TPS2Request<3> request;
+    UInt8 commands[] = { kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1, kDP_SetMouseScaling1To1 };
+    TPS2Request<1> request;
     
     if (!alps_passthrough_mode_v3(regBase, true)) {
         return kIOReturnIOError;
@@ -2010,16 +2253,13 @@ IOReturn ALPS::alps_setup_trackstick_v3(int regBase) {
          * work at all and the trackstick just emits normal
          * PS/2 packets.
          */
-        request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[0].inOrOut = kDP_SetMouseScaling1To1;
-        request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[1].inOrOut = kDP_SetMouseScaling1To1;
-        request.commands[2].command = kPS2C_SendMouseCommandAndCompareAck;
-        request.commands[2].inOrOut = kDP_SetMouseScaling1To1;
-        request.commandsCount = 3;
+        request.commands[0].command = kPS2C_SendMouseCommandsAndCompareAck;
+        request.commands[0].buffer = commands;
+        request.commands[0].count = countof(commands);
+        request.commandsCount = 1;
         assert(request.commandsCount <= countof(request.commands));
         _device->submitRequestAndBlock(&request);
-        if (request.commandsCount != 3) {
+        if (request.commandsCount != 1) {
             IOLog("ALPS: error sending magic E6 scaling sequence\n");
             ret = kIOReturnIOError;
             goto error;
@@ -2101,6 +2341,7 @@ bool ALPS::alps_hw_init_v3() {
     /* Set rate and enable data reporting */
     ps2_command(0x28, kDP_SetMouseSampleRate);
     ps2_command_short(kDP_Enable);
+    _fullRate = 0x28;
     
     return true;
     
@@ -2270,6 +2511,7 @@ bool ALPS::alps_hw_init_v4() {
     /* Set rate and enable data reporting */
     ps2_command(0x64, kDP_SetMouseSampleRate);
     ps2_command_short(kDP_Enable);
+    _fullRate = 0x64;
     return true;
     
 error:
@@ -2279,44 +2521,21 @@ error:
 
 void ALPS::alps_get_otp_values_ss4_v2(unsigned char index)
 {
-    int cmd = 0;
-    TPS2Request<4> request;
+    ALPSStatus_t status;
+    UInt8 info[] = { kDP_GetMouseInformation };
     
+    // knocks are fire and forget, as in alps_monitor_mode
     switch (index) {
         case 0:
             ps2_command_short(kDP_SetMouseStreamMode);
             ps2_command_short(kDP_SetMouseStreamMode);
-            
-            request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-            request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commandsCount = cmd;
-            assert(request.commandsCount <= countof(request.commands));
-            _device->submitRequestAndBlock(&request);
-            
+            alps_command_report(info, countof(info), &status);
             break;
             
         case 1:
             ps2_command_short(kDP_MouseSetPoll);
             ps2_command_short(kDP_MouseSetPoll);
-            
-            request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-            request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commands[cmd].command = kPS2C_ReadDataPort;
-            request.commands[cmd++].inOrOut = 0;
-            request.commandsCount = cmd;
-            assert(request.commandsCount <= countof(request.commands));
-            _device->submitRequestAndBlock(&request);
-            
+            alps_command_report(info, countof(info), &status);
             break;
     }
 }
@@ -2331,34 +2550,20 @@ void ALPS::alps_set_defaults_ss4_v2(struct alps_data *priv)
 int ALPS::alps_dolphin_get_device_area(struct alps_data *priv)
 {
     int num_x_electrode, num_y_electrode;
-    TPS2Request<4> request;
-    int cmd = 0;
+    UInt8 info[] = { kDP_GetMouseInformation };
     ALPSStatus_t status;
     
     alps_enter_command_mode();
     
+    // knocks are fire and forget, as in alps_monitor_mode
     ps2_command_short(kDP_MouseResetWrap);
     ps2_command_short(kDP_MouseSetPoll);
     ps2_command_short(kDP_MouseSetPoll);
     ps2_command(0x0a, kDP_SetMouseSampleRate);
     ps2_command(0x0a, kDP_SetMouseSampleRate);
     
-    request.commands[cmd].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmd++].inOrOut = kDP_GetMouseInformation;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commands[cmd].command = kPS2C_ReadDataPort;
-    request.commands[cmd++].inOrOut = 0;
-    request.commandsCount = cmd;
-    assert(request.commandsCount <= countof(request.commands));
-    _device->submitRequestAndBlock(&request);
-    
     /* results */
-    status.bytes[0] = request.commands[1].inOrOut;
-    status.bytes[1] = request.commands[2].inOrOut;
-    status.bytes[2] = request.commands[3].inOrOut;
+    alps_command_report(info, countof(info), &status);
     
     num_x_electrode = DOLPHIN_PROFILE_XOFFSET + (status.bytes[2] & 0x0F);
     num_y_electrode = DOLPHIN_PROFILE_YOFFSET + ((status.bytes[2] >> 4) & 0x0F);
@@ -2408,6 +2613,7 @@ bool ALPS::alps_hw_init_v7(){
     
     ps2_command(0x28, kDP_SetMouseSampleRate);
     ps2_command_short(kDP_Enable);
+    _fullRate = 0x28;
     
     return true;
     
@@ -2439,18 +2645,445 @@ bool ALPS::alps_hw_init_ss4_v2()
 
 void ALPS::ps2_command(unsigned char value, UInt8 command)
 {
-    TPS2Request<2> request;
-    int cmdCount = 0;
+    TPS2Request<1> request;
+    UInt8 commands[] = { command, value };
     
-    request.commands[cmdCount].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmdCount++].inOrOut = command;
-    request.commands[cmdCount].command = kPS2C_SendMouseCommandAndCompareAck;
-    request.commands[cmdCount++].inOrOut = value;
-    request.commandsCount = cmdCount;
+    request.commands[0].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[0].buffer = commands;
+    request.commands[0].count = countof(commands);
+    request.commandsCount = 1;
     assert(request.commandsCount <= countof(request.commands));
     _device->submitRequestAndBlock(&request);
     
-    //return request.commandsCount = cmdCount;
+    //return request.commandsCount == 1;
+}
+
+bool ALPS::setReportRate(int rate, bool wait)
+{
+    //
+    // Only called for protocols whose hw_init set _fullRate.  The 0x64 0x28
+    // pair used by Dolphin and SS4 is an absolute mode knock, not a rate,
+    // so those are left alone.
+    //
+    // The device is streaming, so reporting is stopped around the change
+    // (as Linux psmouse does): otherwise the ACKs interleave with packet
+    // bytes.  Whatever part of a packet was in flight is dropped.
+    //
+    // Without wait the change is only queued, for the first touch after
+    // idle: the packet loop goes on, and the framing resyncs on whatever
+    // comes after the F4.  Same two requests, so F4 is sent even if the
+    // rate is refused.
+    //
+    
+    if (!wait) {
+        PS2Request* request = _device->allocateRequest(3);
+        PS2Request* enable = _device->allocateRequest(1);
+        if (!request || !enable) {
+            if (request)
+                _device->freeRequest(request);
+            if (enable)
+                _device->freeRequest(enable);
+            return false;
+        }
+        request->commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+        request->commands[0].inOrOut = kDP_SetDefaultsAndDisable;
+        request->commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
+        request->commands[1].inOrOut = kDP_SetMouseSampleRate;
+        request->commands[2].command = kPS2C_SendMouseCommandAndCompareAck;
+        request->commands[2].inOrOut = (UInt8)rate;
+        request->commandsCount = 3;
+        enable->commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+        enable->commands[0].inOrOut = kDP_Enable;
+        enable->commandsCount = 1;
+        _resyncPending = true;
+        _device->submitRequest(request);
+        _device->submitRequest(enable);
+        return true;
+    }
+    
+    TPS2Request<1> request;
+    UInt8 commands[] = { kDP_SetDefaultsAndDisable, kDP_SetMouseSampleRate, (UInt8)rate };
+    request.commands[0].command = kPS2C_SendMouseCommandsAndCompareAck;
+    request.commands[0].buffer = commands;
+    request.commands[0].count = countof(commands);
+    request.commandsCount = 1;
+    assert(request.commandsCount <= countof(request.commands));
+    _device->submitRequestAndBlock(&request);
+    bool success = 1 == request.commandsCount;
+    
+    _packetByteCount = 0;
+    
+    TPS2Request<1> enable;
+    enable.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+    enable.commands[0].inOrOut = kDP_Enable;
+    enable.commandsCount = 1;
+    assert(enable.commandsCount <= countof(enable.commands));
+    _device->submitRequestAndBlock(&enable);
+    
+    return success && 1 == enable.commandsCount;
+}
+
+bool ALPS::recoverDevice(int level)
+{
+    //
+    // Steps of the bad packet supervisor (see noteBadPacket), cheapest
+    // first.  The stream reset keeps the absolute mode set up by hw_init,
+    // the restart resets the device and runs hw_init again.  That one is
+    // called off the workloop with the device locked (see restartDevice).
+    //
+    
+    switch (level) {
+        case kRecoverResync:
+            _resyncPending = true;
+            return true;
+            
+        case kRecoverStream: {
+            TPS2Request<2> request;
+            request.commands[0].command = kPS2C_SendMouseCommandAndCompareAck;
+            request.commands[0].inOrOut = kDP_SetDefaultsAndDisable;
+            request.commands[1].command = kPS2C_SendMouseCommandAndCompareAck;
+            request.commands[1].inOrOut = kDP_Enable;
+            request.commandsCount = 2;
+            assert(request.commandsCount <= countof(request.commands));
+            _resyncPending = true;
+            _device->submitRequestAndBlock(&request);
+            return 2 == request.commandsCount;
+        }
+            
+        case kRecoverRestart:
+            // identify is not repeated, the device is still the same one
+            resetMouse();
+            return deviceSpecificInit();
+    }
+    return false;
+}
+
+void ALPS::publishDecodeStats()
+{
+    //
+    // Counters since start, only the packet types seen so far, and the
+    // sampled decode time (ns) as "DecodeStats".
+    //
+    
+    OSDictionary* stats = OSDictionary::withCapacity(kStatCount + 3);
+    if (!stats)
+        return;
+    for (unsigned i = 0; i < countof(decodeStatNames) && i < kStatCount; i++) {
+        if (!_decodeStats[i])
+            continue;
+        OSNumber* num = OSNumber::withNumber(_decodeStats[i], 32);
+        if (num) {
+            stats->setObject(decodeStatNames[i], num);
+            num->release();
+        }
+    }
+    
+    uint64_t avg = _decodeSamples ? _decodeTime / _decodeSamples : 0, max = _decodeTimeMax;
+    absolutetime_to_nanoseconds(avg, &avg);
+    absolutetime_to_nanoseconds(max, &max);
+    const struct { const char* name; UInt32 value; } times[] = {
+        { "DecodeTimeSamples", _decodeSamples },
+        { "DecodeTimeAvg", (UInt32)avg },
+        { "DecodeTimeMax", (UInt32)max },
+    };
+    for (unsigned i = 0; i < countof(times); i++) {
+        OSNumber* num = OSNumber::withNumber(times[i].value, 32);
+        if (num) {
+            stats->setObject(times[i].name, num);
+            num->release();
+        }
+    }
+    
+    setProperty("DecodeStats", stats);
+    stats->release();
+}
+
+bool ALPS::benchModel(ALPSEncoderModel* model)
+{
+    // only the protocols decoded through decode_fields are covered
+    switch (priv.proto_version) {
+        case ALPS_PROTO_V3:
+        case ALPS_PROTO_V3_RUSHMORE:
+        case ALPS_PROTO_V5:
+        case ALPS_PROTO_V7:
+        case ALPS_PROTO_V8:
+            break;
+        default:
+            return false;
+    }
+    
+    model->proto_version = priv.proto_version;
+    model->byte0 = priv.byte0;
+    model->x_max = priv.x_max;
+    model->y_max = priv.y_max;
+    model->x_bits = priv.x_bits;
+    model->y_bits = priv.y_bits;
+    model->buttonpad = priv.flags & ALPS_BUTTONPAD;
+    model->interleaved = false;
+    return true;
+}
+
+void ALPS::benchFrame(const ALPSEncoderModel& model, UInt32* seed, ALPSEncoderFrame* frame)
+{
+    // pseudo random touchpad frame, the same sequence for the same seed
+    int maxFingers = model.proto_version >= ALPS_PROTO_V7 ? 5 : 2;
+    bzero(frame, sizeof(*frame));
+    *seed = *seed * 1103515245 + 12345;
+    frame->fingers = (*seed >> 16) % (maxFingers + 1);
+    frame->pressure = frame->fingers ? 0x30 : 0;
+    frame->buttons = model.buttonpad ? (*seed >> 8) & 1 : (*seed >> 8) & 3;
+    for (int j = 0; j < frame->fingers && j < 4; j++) {
+        *seed = *seed * 1103515245 + 12345;
+        frame->mt[j].x = 1 + (*seed >> 8) % model.x_max;
+        frame->mt[j].y = 1 + (*seed >> 20) % model.y_max;
+    }
+}
+
+bool ALPS::checkFrame(const ALPSEncoderModel& model, const ALPSEncoderFrame& frame, UInt8* p, size_t length)
+{
+    //
+    // Does decode_fields give back what the encoder was given?  Positions
+    // are exact, except what the protocol can't carry: the bitmap
+    // protocols only have a finger count for the second contact, V7 has
+    // a coarser second contact, and SS4 drops low bits with more than one
+    // finger.
+    //
+    
+    struct alps_fields f;
+    bzero(&f, sizeof(f));
+    
+    switch (model.proto_version) {
+        case ALPS_PROTO_V3:
+        case ALPS_PROTO_V3_RUSHMORE:
+        case ALPS_PROTO_V5:
+            (this->*decode_fields)(&f, p);
+            if (f.is_mp || (int)f.st.x != frame.mt[0].x || (int)f.st.y != frame.mt[0].y || f.pressure != frame.pressure)
+                return false;
+            if (f.left != (frame.buttons & 1) || f.right != !!(frame.buttons & 2) || f.middle != !!(frame.buttons & 4))
+                return false;
+            if (f.first_mp != (frame.fingers >= 2))
+                return false;
+            if (frame.fingers >= 2) {
+                if (length < 12)
+                    return false;
+                bzero(&f, sizeof(f));
+                (this->*decode_fields)(&f, p + 6);
+                if (!f.is_mp || (int)f.fingers != frame.fingers)
+                    return false;
+            }
+            return true;
+            
+        case ALPS_PROTO_V7:
+            if (!(this->*decode_fields)(&f, p))
+                return false;
+            if (!frame.fingers && !frame.buttons)
+                return V7_PACKET_ID_IDLE == alps_get_packet_id_v7(p);
+            if ((int)f.fingers != frame.fingers || f.left != (frame.buttons & 1))
+                return false;
+            if (!model.buttonpad && (f.right != !!(frame.buttons & 2) || f.middle != !!(frame.buttons & 4)))
+                return false;
+            if (frame.fingers >= 1 && ((int)f.mt[0].x != frame.mt[0].x || (int)f.mt[0].y != frame.mt[0].y))
+                return false;
+            if (frame.fingers >= 2 && (abs((int)f.mt[1].x - frame.mt[1].x) >= 64 || abs((int)f.mt[1].y - frame.mt[1].y) >= 32))
+                return false;
+            return true;
+            
+        case ALPS_PROTO_V8: {
+            // as alps_process_packet_ss4_v2, but with its own multi_data
+            UInt8 first[6];
+            bool mp = false;
+            for (size_t k = 0; k + 6 <= length; k += 6) {
+                bzero(&f, sizeof(f));
+                (this->*decode_fields)(&f, p + k);
+                if (mp) {
+                    if (!f.is_mp)
+                        return false;
+                    (this->*decode_fields)(&f, first);
+                    mp = false;
+                } else if (f.is_mp) {
+                    return false;
+                } else if (f.first_mp) {
+                    memcpy(first, p + k, sizeof(first));
+                    mp = true;
+                }
+            }
+            if (mp)
+                return false;
+            if (f.left != (frame.buttons & 1) || (int)f.fingers != frame.fingers)
+                return false;
+            if (!model.buttonpad && (f.right != !!(frame.buttons & 2) || f.middle != !!(frame.buttons & 4)))
+                return false;
+            if (1 == frame.fingers)
+                return (int)f.mt[0].x == frame.mt[0].x && (int)f.mt[0].y == frame.mt[0].y && f.pressure == frame.pressure;
+            int xmask = model.buttonpad ? ~0xf : ~0x1f, ymask = model.buttonpad ? ~7 : ~0xf;
+            for (int i = 0; i < frame.fingers && i < 4; i++) {
+                if ((int)f.mt[i].x != (frame.mt[i].x & xmask) || (int)f.mt[i].y != (frame.mt[i].y & ymask))
+                    return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ALPS::runDecodeCheck()
+{
+    //
+    // Round trip: encodes kCheckFrames random frames for this device's
+    // protocol (see alps_encoder.h), decodes them with decode_fields and
+    // compares, publishing DecodeCheckFrames and DecodeCheckMismatches.
+    // The first mismatch is logged with its bytes.  Touches nothing the
+    // live decode uses but the statistics, which are put back.
+    //
+    
+    ALPSEncoderModel model;
+    if (!benchModel(&model))
+        return;
+    ALPSPacketEncoder encoder(model);
+    
+    enum { kCheckFrames = 4096 };
+    UInt32 saved[kStatCount];
+    memcpy(saved, _decodeStats, sizeof(saved));
+    
+    UInt32 seed = 1, mismatches = 0;
+    for (int i = 0; i < kCheckFrames; i++) {
+        ALPSEncoderFrame frame;
+        UInt8 bytes[kALPSEncoderMaxBytes];
+        benchFrame(model, &seed, &frame);
+        size_t length = encoder.encode(frame, bytes);
+        if (length && checkFrame(model, frame, bytes, length))
+            continue;
+        if (!mismatches++)
+            IOLog("ALPS: decode check: frame %d (fingers %d at %d,%d) came back different: %02x %02x %02x %02x %02x %02x\n", i, frame.fingers, frame.mt[0].x, frame.mt[0].y, bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5]);
+    }
+    
+    memcpy(_decodeStats, saved, sizeof(saved));
+    setProperty("DecodeCheckFrames", kCheckFrames, 32);
+    setProperty("DecodeCheckMismatches", mismatches, 32);
+}
+
+void ALPS::runDecodeBench()
+{
+    //
+    // Encodes kBenchFrames random frames for this device's protocol (see
+    // alps_encoder.h) and times decode_fields over the resulting packets,
+    // then decode_fields plus dispatchEventsWithInfo, so a change to the
+    // decoders, the gesture code or the layout of alps_data and
+    // TouchPadFrame can be compared without moving a finger.  The
+    // dispatch runs twice: with the frame block on a cache line, as it is
+    // allocated, and moved half a line so that it straddles one more.
+    // Runs on the workloop, which is held for a few milliseconds at most.
+    //
+    
+    ALPSEncoderModel model;
+    if (!benchModel(&model))
+        return;
+    ALPSPacketEncoder encoder(model);
+    
+    enum { kBenchFrames = 1024 };
+    const size_t size = kBenchFrames * kALPSEncoderMaxBytes;
+    UInt8* stream = (UInt8*)IOMalloc(size);
+    if (!stream)
+        return;
+    
+    // fixed seed, so runs compare
+    UInt32 seed = 1;
+    size_t length = 0;
+    for (int i = 0; i < kBenchFrames; i++) {
+        ALPSEncoderFrame frame;
+        benchFrame(model, &seed, &frame);
+        length += encoder.encode(frame, stream + length);
+    }
+    
+    // the V7 decoder counts packet ids, those are for real packets only
+    UInt32 saved[kStatCount];
+    memcpy(saved, _decodeStats, sizeof(saved));
+    
+    struct alps_fields f;
+    unsigned packets = 0;
+    uint64_t begin, end;
+    clock_get_uptime(&begin);
+    for (size_t k = 0; k + priv.pktsize <= length; k += priv.pktsize, packets++) {
+        bzero(&f, sizeof(f));
+        (this->*decode_fields)(&f, stream + k);
+    }
+    clock_get_uptime(&end);
+    
+    uint64_t ns;
+    absolutetime_to_nanoseconds(end - begin, &ns);
+    setProperty("DecodeBenchPackets", packets, 32);
+    setProperty("DecodeBenchTime", (UInt32)ns, 32);
+    if (packets)
+        setProperty("DecodeBenchAvg", (UInt32)(ns / packets), 32);
+    
+    // one more line than the block needs, for the straddling run
+    const size_t scratchSize = frameSize() + kFrameAlign;
+    UInt8* scratch = (UInt8*)IOMallocAligned(scratchSize, kFrameAlign);
+    if (scratch) {
+        unsigned dispatched;
+        uint64_t aligned = benchDispatch(stream, length, (TouchPadFrame*)scratch, &dispatched);
+        uint64_t offset = benchDispatch(stream, length, (TouchPadFrame*)(scratch + kFrameAlign / 2), &dispatched);
+        IOFreeAligned(scratch, scratchSize);
+        setProperty("DecodeBenchDispatched", dispatched, 32);
+        setProperty("DecodeBenchDispatchTime", (UInt32)aligned, 32);
+        setProperty("DecodeBenchDispatchTimeOffset", (UInt32)offset, 32);
+    }
+    
+    memcpy(_decodeStats, saved, sizeof(saved));
+    IOFree(stream, size);
+}
+
+uint64_t ALPS::benchDispatch(UInt8* stream, size_t length, TouchPadFrame* frame, unsigned* dispatched)
+{
+    //
+    // decode_fields and dispatchEventsWithInfo over the stream, with frame
+    // standing in for _frame and _benchRunning keeping the events, timers
+    // and telemetry from going anywhere.  frame starts out as after init,
+    // so each run sees the same gestures.  Only the left button is passed
+    // on; with both, the middle button emulation would publish its
+    // statistics from inside the timed loop.  Returns ns.
+    //
+    
+    bzero(frame, sizeof(*frame));
+    frame->_scrollUnits = _frame->_scrollUnits;
+    frame->_packetTime = _frame->_packetTime;
+    uint64_t step;
+    nanoseconds_to_absolutetime(10000000, &step);   // 100 reports/s
+    
+    TouchPadFrame* live = _frame;
+    bool idle = _packetIdle;
+    _frame = frame;
+    _benchRunning = true;
+    
+    struct alps_fields f;
+    bool bitmap = priv.proto_version < ALPS_PROTO_V7;
+    unsigned count = 0;
+    uint64_t begin, end;
+    clock_get_uptime(&begin);
+    for (size_t k = 0; k + priv.pktsize <= length; k += priv.pktsize) {
+        bzero(&f, sizeof(f));
+        (this->*decode_fields)(&f, stream + k);
+        // the bitmap half of a multi-packet report only refines the first
+        if (f.is_mp)
+            continue;
+        _frame->_packetTime += step;
+        int fingers = f.fingers ? f.fingers : f.pressure > 0;
+        if (bitmap)
+            dispatchEventsWithInfo(f.st.x, f.st.y, f.pressure, fingers, f.left);
+        else
+            dispatchEventsWithInfo(f.mt[0].x, f.mt[0].y, f.pressure, fingers, f.left);
+        count++;
+    }
+    clock_get_uptime(&end);
+    
+    _benchRunning = false;
+    _frame = live;
+    _packetIdle = idle;
+    
+    uint64_t ns;
+    absolutetime_to_nanoseconds(end - begin, &ns);
+    *dispatched = count;
+    return ns;
 }
 
 void ALPS::ps2_command_short(UInt8 command)
@@ -2666,8 +3299,12 @@ IOReturn ALPS::identify() {
      * ALPS should return 0,0,10 or 0,0,100 if no buttons are pressed.
      * The bits 0-2 of the first byte will be 1s if some buttons are
      * pressed.
+     *
+     * A device that is not ALPS may never answer these, so don't wait the
+     * full read budget for each byte; 20ms is what any device gets.
      */
     
+    _reportTimeoutMS = 25;
     if (!alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_SetMouseScaling1To1, &e6)) {
         IOLog("ALPS: identify: not an ALPS device. Error getting E6 report\n");
         //return kIOReturnIOError;
@@ -2682,9 +3319,10 @@ IOReturn ALPS::identify() {
      * Now get the "E7" and "EC" reports.  These will uniquely identify
      * most ALPS touchpads.
      */
-    if (!(alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_SetMouseScaling2To1, &e7) &&
-          alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_MouseResetWrap, &ec) &&
-          alps_exit_command_mode())) {
+    bool reports = alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_SetMouseScaling2To1, &e7) &&
+        alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_MouseResetWrap, &ec);
+    _reportTimeoutMS = 0;
+    if (!(reports && alps_exit_command_mode())) {
         IOLog("ALPS: identify: not an ALPS device. Error getting E7/EC report\n");
         return kIOReturnIOError;
     }
@@ -2740,10 +3378,13 @@ IOReturn ALPS::identify() {
 /* ============================================================================================== */
 
 void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32 buttonsraw) {
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _frame->_packetTime;
     uint64_t now_ns;
     absolutetime_to_nanoseconds(now_abs, &now_ns);
+    telemetry(kPS2TE_Decode, fingers, xraw, yraw, z, buttonsraw);
+    
+    // prediction lead taken back when the predictors are reset (see MotionPredictor)
+    int predx = 0, predy = 0;
     
     // scale x & y to the axis which has the most resolution
     if (xupmm < yupmm) {
@@ -2760,10 +3401,12 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
     int y = yraw;
     
     fingers = z > z_finger ? fingers : 0;
+    fingers = debounceFingers(fingers, z);
+    _packetIdle = !fingers && !buttonsraw;
     
     // allow middle click to be simulated the other two physical buttons
     UInt32 buttons = buttonsraw;
-    lastbuttons = buttons;
+    _frame->lastbuttons = buttons;
     
     // allow middle button to be simulated with two buttons down
     if (!clickpadtype || fingers == 3) {
@@ -2772,53 +3415,64 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
     }
     
     // recalc middle buttons if finger is going down
-    if (0 == last_fingers && fingers > 0) {
-        buttons = middleButton(buttonsraw | passbuttons, now_abs, fromCancel);
+    if (0 == _frame->last_fingers && fingers > 0) {
+        buttons = middleButton(buttonsraw | _frame->passbuttons, now_abs, fromCancel);
     }
     
-    if (last_fingers > 0 && fingers > 0 && last_fingers != fingers) {
-        // ignore deltas for a while after finger change
-        ignoredeltas = ignoredeltasstart;
+    if (_frame->last_fingers > 0 && fingers > 0 && _frame->last_fingers != fingers && !_frame->_fingersCarried && !_contactKept) {
+        // ignore deltas for a while after finger change, unless the position
+        // was carried across it: followed while debounceFingers held the
+        // change, or the contact tracker kept the primary contact
+        _frame->ignoredeltas = ignoredeltasstart;
     }
     
-    if (last_fingers != fingers) {
+    if (_frame->last_fingers != fingers) {
         DEBUG_LOG("Finger change, reset averages\n");
         // reset averages after finger change
-        x_undo.reset();
-        y_undo.reset();
-        x_avg.reset();
-        y_avg.reset();
+        _frame->x_undo.reset();
+        _frame->y_undo.reset();
+        _frame->x_avg.reset();
+        _frame->y_avg.reset();
+        predx += _frame->x_pred.reset();
+        predy -= _frame->y_pred.reset();
     }
     
     // unsmooth input (probably just for testing)
     // by default the trackpad itself does a simple decaying average (1/2 each)
     // we can undo it here
     if (unsmoothinput) {
-        x = x_undo.filter(x);
-        y = y_undo.filter(y);
+        x = _frame->x_undo.filter(x);
+        y = _frame->y_undo.filter(y);
     }
     
     // smooth input by unweighted average
     if (smoothinput) {
-        x = x_avg.filter(x);
-        y = y_avg.filter(y);
-    }
-    
-    if (ignoredeltas) {
-        DEBUG_LOG("ALPS: Still ignoring deltas. Value=%d\n", ignoredeltas);
-        lastx = x;
-        lasty = y;
-        if (--ignoredeltas == 0) {
-            x_undo.reset();
-            y_undo.reset();
-            x_avg.reset();
-            y_avg.reset();
+        x = _frame->x_avg.filter(x);
+        y = _frame->y_avg.filter(y);
+    }
+    
+    if (_frame->_fingersPending) {
+        // finger change not confirmed yet: hold still, but follow the
+        // position so there is no jump when it is
+        _frame->lastx = x;
+        _frame->lasty = y;
+    }
+    
+    if (_frame->ignoredeltas) {
+        DEBUG_LOG("ALPS: Still ignoring deltas. Value=%d\n", _frame->ignoredeltas);
+        _frame->lastx = x;
+        _frame->lasty = y;
+        if (--_frame->ignoredeltas == 0) {
+            _frame->x_undo.reset();
+            _frame->y_undo.reset();
+            _frame->x_avg.reset();
+            _frame->y_avg.reset();
         }
     }
     
     // deal with "OutsidezoneNoAction When Typing"
-    if (outzone_wt && z > z_finger && now_ns - keytime < maxaftertyping &&
-        (x < zonel || x > zoner || y < zoneb || y > zonet)) {
+    if (outzone_wt && z > z_finger && now_ns - _frame->keytime < maxaftertyping &&
+        !(classifyZone(x, y) & kZoneTyping)) {
         DEBUG_LOG("Ignore touch input after typing\n");
         // touch input was shortly after typing and outside the "zone"
         // ignore it...
@@ -2826,106 +3480,106 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
     }
     
     // if trackpad input is supposed to be ignored, then don't do anything
-    if (ignoreall) {
+    if (_frame->ignoreall) {
         DEBUG_LOG("ignoreall is set, returning\n");
         return;
     }
     
-#ifdef DEBUG
-    int tm1 = touchmode;
-#endif
-    DEBUG_LOG("VoodooPS2::Mode: %d\n", touchmode);
+    int tm1 = _frame->touchmode;
+    DEBUG_LOG("VoodooPS2::Mode: %d\n", _frame->touchmode);
     if (z < z_finger && isTouchMode()) {
         // Finger has been lifted
         DEBUG_LOG("finger lifted after touch\n");
-        xrest = yrest = scrollrest = 0;
-        inSwipeLeft = inSwipeRight = inSwipeUp = inSwipeDown = 0;
-        inSwipe4Left = inSwipe4Right = inSwipe4Up = inSwipe4Down = 0;
-        xmoved = ymoved = 0;
-        untouchtime = now_ns;
+        _frame->xrest = _frame->yrest = _frame->scrollrest = 0;
+        _frame->inSwipeLeft = _frame->inSwipeRight = _frame->inSwipeUp = _frame->inSwipeDown = 0;
+        _frame->inSwipe4Left = _frame->inSwipe4Right = _frame->inSwipe4Up = _frame->inSwipe4Down = 0;
+        _frame->xmoved = _frame->ymoved = 0;
+        _frame->untouchtime = now_ns;
+        predx += _frame->x_pred.reset();
+        predy -= _frame->y_pred.reset();
         
-        DEBUG_LOG("finger lifted -> touchmode: %d history: %d", touchmode, dy_history.count());
-        DEBUG_LOG("PS2: wastriple: %d wasdouble: %d touchtime: %llu", wastriple, wasdouble, touchtime);
+        DEBUG_LOG("finger lifted -> touchmode: %d history: %d", _frame->touchmode, _frame->dy_history.count());
+        DEBUG_LOG("PS2: wastriple: %d wasdouble: %d touchtime: %llu", _frame->wastriple, _frame->wasdouble, _frame->touchtime);
         
         // check for scroll momentum start
-        if ((MODE_MTOUCH == touchmode || MODE_VSCROLL == touchmode) && momentumscroll && momentumscrolltimer) {
+        if ((MODE_MTOUCH == _frame->touchmode || MODE_VSCROLL == _frame->touchmode) && momentumscroll && momentumscrolltimer) {
             // releasing when we were in touchmode -- check for momentum scroll
-            if (dy_history.count() > momentumscrollsamplesmin &&
-                (momentumscrollinterval = time_history.newest() - time_history.oldest())) {
-                momentumscrollsum = dy_history.sum();
-                momentumscrollcurrent = momentumscrolltimer * momentumscrollsum;
-                momentumscrollrest1 = 0;
-                momentumscrollrest2 = 0;
+            if (_frame->dy_history.count() > momentumscrollsamplesmin &&
+                (_frame->momentumscrollinterval = _frame->time_history.newest() - _frame->time_history.oldest())) {
+                _frame->momentumscrollsum = _frame->dy_history.sum();
+                _frame->momentumscrollcurrent = momentumscrolltimer * _frame->momentumscrollsum;
+                _frame->momentumscrollrest1 = 0;
+                _frame->momentumscrollrest2 = 0;
                 setTimerTimeout(scrollTimer, momentumscrolltimer);
             }
         }
-        time_history.reset();
-        dy_history.reset();
+        _frame->time_history.reset();
+        _frame->dy_history.reset();
         
-        if (now_ns - touchtime < maxtaptime && clicking) {
-            switch (touchmode) {
+        if (now_ns - _frame->touchtime < maxtaptime && clicking) {
+            switch (_frame->touchmode) {
                 case MODE_DRAG:
                     if (!immediateclick) {
                         buttons &= ~0x7;
                         dispatchRelativePointerEventX(0, 0, buttons | 0x1, now_abs);
                         dispatchRelativePointerEventX(0, 0, buttons, now_abs);
                     }
-                    if (wastriple && rtap) {
+                    if (_frame->wastriple && rtap) {
                         buttons |= !swapdoubletriple ? 0x4 : 0x02;
-                    } else if (wasdouble && rtap) {
+                    } else if (_frame->wasdouble && rtap) {
                         buttons |= !swapdoubletriple ? 0x2 : 0x04;
                     } else {
                         buttons |= 0x1;
                     }
-                    touchmode = MODE_NOTOUCH;
+                    _frame->touchmode = MODE_NOTOUCH;
                     break;
                     
                 case MODE_DRAGLOCK:
-                    touchmode = MODE_NOTOUCH;
+                    _frame->touchmode = MODE_NOTOUCH;
                     break;
                     
                 default: //dispatch taps
-                    if (wastriple && rtap)
+                    if (_frame->wastriple && rtap)
                     {
                         buttons |= !swapdoubletriple ? 0x4 : 0x02;
-                        touchmode=MODE_NOTOUCH;
+                        _frame->touchmode=MODE_NOTOUCH;
                     }
-                    else if (wasdouble && rtap)
+                    else if (_frame->wasdouble && rtap)
                     {
                         buttons |= !swapdoubletriple ? 0x2 : 0x04;
-                        touchmode=MODE_NOTOUCH;
+                        _frame->touchmode=MODE_NOTOUCH;
                     }
                     else
                     {
                         buttons |= 0x1;
-                        touchmode=dragging ? MODE_PREDRAG : MODE_NOTOUCH;
+                        _frame->touchmode=dragging ? MODE_PREDRAG : MODE_NOTOUCH;
                     }
                     break;
             }
         }
         else {
-            if ((touchmode==MODE_DRAG || touchmode==MODE_DRAGLOCK)
-                && (draglock || draglocktemp || (dragTimer && dragexitdelay)))
+            if ((_frame->touchmode==MODE_DRAG || _frame->touchmode==MODE_DRAGLOCK)
+                && (draglock || _frame->draglocktemp || (dragTimer && dragexitdelay)))
             {
-                touchmode=MODE_DRAGNOTOUCH;
-                if (!draglock && !draglocktemp)
+                _frame->touchmode=MODE_DRAGNOTOUCH;
+                if (!draglock && !_frame->draglocktemp)
                 {
                     cancelTimer(dragTimer);
                     setTimerTimeout(dragTimer, dragexitdelay);
                 }
             } else {
-                touchmode = MODE_NOTOUCH;
-                draglocktemp = 0;
+                _frame->touchmode = MODE_NOTOUCH;
+                _frame->draglocktemp = 0;
             }
         }
-        wasdouble = false;
-        wastriple = false;
+        _frame->wasdouble = false;
+        _frame->wastriple = false;
     }
     
     // cancel pre-drag mode if second tap takes too long
-    if (touchmode == MODE_PREDRAG && now_ns - untouchtime >= maxdragtime) {
+    if (_frame->touchmode == MODE_PREDRAG && now_ns - _frame->untouchtime >= maxdragtime) {
         DEBUG_LOG("cancel pre-drag since second tap took too long\n");
-        touchmode = MODE_NOTOUCH;
+        _frame->touchmode = MODE_NOTOUCH;
     }
     
     // Note: This test should probably be done somewhere else, especially if to
@@ -2933,45 +3587,54 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
     // erasing here (time of touch) might be useful for certain gestures...
     
     // cancel tap if touch point moves too far
-    if (isTouchMode() && isFingerTouch(z) && last_fingers == fingers) {
-        int dy = abs(touchy-y);
-        int dx = abs(touchx-x);
+    if (isTouchMode() && isFingerTouch(z) && _frame->last_fingers == fingers) {
+        int dy = abs(_frame->touchy-y);
+        int dx = abs(_frame->touchx-x);
         DEBUG_LOG("PS2: Cancel DX: %d Cancel DY: %d", dx, dy);
-        if (!wasdouble && !wastriple && (dx > tapthreshx || dy > tapthreshy)) {
-            touchtime = 0;
+        if (!_frame->wasdouble && !_frame->wastriple && (dx > tapthreshx || dy > tapthreshy)) {
+            _frame->touchtime = 0;
         }
         else if (dx > dblthreshx || dy > dblthreshy) {
-            touchtime = 0;
+            _frame->touchtime = 0;
         }
     }
     
 #ifdef DEBUG
-    int tm2 = touchmode;
+    int tm2 = _frame->touchmode;
 #endif
     int dx = 0, dy = 0;
     
-    switch (touchmode) {
+    switch (_frame->touchmode) {
         case MODE_DRAG:
         case MODE_DRAGLOCK:
-            if (MODE_DRAGLOCK == touchmode || (!immediateclick || now_ns - touchtime > maxdbltaptime)) {
+            if (MODE_DRAGLOCK == _frame->touchmode || (!immediateclick || now_ns - _frame->touchtime > maxdbltaptime)) {
                 buttons |= 0x1;
             }
             // fall through
         case MODE_MOVE:
-            if (last_fingers == fingers && z<=zlimit)
+            if (_frame->last_fingers == fingers && z<=zlimit)
             {
-                if (now_ns - touchtime > 100000000) {
-                    if(wasScroll) {
-                        wasScroll = false;
-                        ignoredeltas = ignoredeltasstart;
+                if (now_ns - _frame->touchtime > 100000000) {
+                    if(_frame->wasScroll) {
+                        _frame->wasScroll = false;
+                        if (fingerdebounce <= 1)
+                            _frame->ignoredeltas = ignoredeltasstart;
                         break;
                     }
-                    dx = x-lastx+xrest;
-                    dy = lasty-y+yrest;
-                    xrest = dx % divisorx;
-                    yrest = dy % divisory;
-                    if (abs(dx) > bogusdxthresh || abs(dy) > bogusdythresh)
-                        dx = dy = xrest = yrest = 0;
+                    dx = x-_frame->lastx+_frame->xrest;
+                    dy = _frame->lasty-y+_frame->yrest;
+                    if (predictahead) {
+                        // run ahead of the finger to make up for transfer/smoothing delay
+                        dx += _frame->x_pred.advance(x, now_ns / 1000, predictahead * 1000);
+                        dy -= _frame->y_pred.advance(y, now_ns / 1000, predictahead * 1000);
+                    }
+                    _frame->xrest = dx % divisorx;
+                    _frame->yrest = dy % divisory;
+                    if (abs(dx) > bogusdxthresh || abs(dy) > bogusdythresh) {
+                        dx = dy = _frame->xrest = _frame->yrest = 0;
+                        predx += _frame->x_pred.reset();
+                        predy -= _frame->y_pred.reset();
+                    }
                 }
             }
             break;
@@ -2979,153 +3642,155 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
         case MODE_MTOUCH:
             switch (fingers) {
                 case 1:
-                    if (last_fingers != fingers) break;
+                    if (_frame->last_fingers != fingers) break;
                     
                     // transition from multitouch to single touch
                     // user could be letting go - ignore single for a few
                     // packets to see if they completely let go before
                     // starting to move w/ single finger
-                    if (!wsticky && !scrolldebounce && !ignoresingle)
+                    if (!wsticky && !_frame->scrolldebounce && !_frame->ignoresingle)
                     {
                         cancelTimer(scrollDebounceTIMER);
                         setTimerTimeout(scrollDebounceTIMER, scrollexitdelay);
-                        scrolldebounce = true;
-                        wasScroll = true;
-                        dy_history.reset();
-                        time_history.reset();
-                        touchmode=MODE_MOVE;
+                        _frame->scrolldebounce = true;
+                        _frame->wasScroll = true;
+                        _frame->dy_history.reset();
+                        _frame->time_history.reset();
+                        _frame->touchmode=MODE_MOVE;
                         break;
                     }
                     
                     // Decrement ignore single counter
-                    if (ignoresingle)
-                        ignoresingle--;
+                    if (_frame->ignoresingle)
+                        _frame->ignoresingle--;
                     
                     break;
                 case 2: // two finger
-                    if (last_fingers != fingers) {
+                    if (_frame->last_fingers != fingers) {
                         break;
                     }
                     if (palm && z > zlimit) {
                         break;
                     }
-                    if (palm_wt && now_ns - keytime < maxaftertyping) {
+                    if (palm_wt && now_ns - _frame->keytime < maxaftertyping) {
                         break;
                     }
-                    dy = (wvdivisor) ? (y-lasty+yrest) : 0;
-                    dx = (whdivisor&&hscroll) ? (x-lastx+xrest) : 0;
-                    yrest = (wvdivisor) ? dy % wvdivisor : 0;
-                    xrest = (whdivisor&&hscroll) ? dx % whdivisor : 0;
+                    // in 1/_scrollUnits lines, so the rests keep the fractions
+                    dy = (wvdivisor) ? ((y-_frame->lasty)*_frame->_scrollUnits+_frame->yrest) : 0;
+                    dx = (whdivisor&&hscroll) ? ((x-_frame->lastx)*_frame->_scrollUnits+_frame->xrest) : 0;
+                    _frame->yrest = (wvdivisor) ? dy % wvdivisor : 0;
+                    _frame->xrest = (whdivisor&&hscroll) ? dx % whdivisor : 0;
                     // check for stopping or changing direction
                     DEBUG_LOG("fingers dy: %d", dy);
-                    if ((dy < 0) != (dy_history.newest() < 0) || dy == 0) {
+                    if ((dy < 0) != (_frame->dy_history.newest() < 0) || dy == 0) {
                         // stopped or changed direction, clear history
-                        dy_history.reset();
-                        time_history.reset();
+                        _frame->dy_history.reset();
+                        _frame->time_history.reset();
                     }
                     // put movement and time in history for later
-                    dy_history.filter(dy);
-                    time_history.filter(now_ns);
+                    _frame->dy_history.filter(dy);
+                    _frame->time_history.filter(now_ns);
                     //REVIEW: filter out small movements (Mavericks issue)
-                    if (abs(dx) < scrolldxthresh)
+                    if (abs(dx) < scrolldxthresh * _frame->_scrollUnits)
                     {
-                        xrest = dx;
+                        _frame->xrest = dx;
                         dx = 0;
                     }
-                    if (abs(dy) < scrolldythresh)
+                    if (abs(dy) < scrolldythresh * _frame->_scrollUnits)
                     {
-                        yrest = dy;
+                        _frame->yrest = dy;
                         dy = 0;
                     }
                     if (0 != dy || 0 != dx)
                     {
                         // Don't move unless user is moved fingers far enough to know this wasn't a two finger tap
                         // Gets rid of scrolling while trying to tap 
-                        if (!touchtime)
+                        if (!_frame->touchtime)
                             dispatchScrollWheelEventX(wvdivisor ? dy / wvdivisor : 0, (whdivisor && hscroll) ? -dx / whdivisor : 0, 0, now_abs);
                         dx = dy = 0;
-                        ignoresingle = 3;
+                        // debounceFingers already filters the stray single finger packets
+                        _frame->ignoresingle = fingerdebounce > 1 ? 0 : 3;
                     }
                     break;
                     
                 case 3: // three finger
-                    if (last_fingers != fingers) {
+                    if (_frame->last_fingers != fingers) {
                         break;
                     }
                     
                     if (threefingerhorizswipe || threefingervertswipe) {
                         // Now calculate total movement since 3 fingers down (add to total)
-                        xmoved += lastx-x;
-                        ymoved += y-lasty;
+                        _frame->xmoved += _frame->lastx-x;
+                        _frame->ymoved += y-_frame->lasty;
                         
                         // dispatching 3 finger movement
-                        if (ymoved > swipedy && !inSwipeUp && !inSwipe4Up && threefingervertswipe) {
-                            inSwipeUp = 1;
-                            inSwipeDown = 0;
-                            ymoved = 0;
-                            _device->dispatchKeyboardMessage(kPS2M_swipeUp, &now_abs);
+                        if (_frame->ymoved > swipedy && !_frame->inSwipeUp && !_frame->inSwipe4Up && threefingervertswipe) {
+                            _frame->inSwipeUp = 1;
+                            _frame->inSwipeDown = 0;
+                            _frame->ymoved = 0;
+                            dispatchKeyboardMessageX(kPS2M_swipeUp, &now_abs);
                             break;
                         }
-                        if (ymoved < -swipedy && !inSwipeDown && !inSwipe4Down && threefingervertswipe) {
-                            inSwipeDown = 1;
-                            inSwipeUp = 0;
-                            ymoved = 0;
-                            _device->dispatchKeyboardMessage(kPS2M_swipeDown, &now_abs);
+                        if (_frame->ymoved < -swipedy && !_frame->inSwipeDown && !_frame->inSwipe4Down && threefingervertswipe) {
+                            _frame->inSwipeDown = 1;
+                            _frame->inSwipeUp = 0;
+                            _frame->ymoved = 0;
+                            dispatchKeyboardMessageX(kPS2M_swipeDown, &now_abs);
                             break;
                         }
-                        if (xmoved < -swipedx && !inSwipeRight && !inSwipe4Right && threefingerhorizswipe) {
-                            inSwipeRight = 1;
-                            inSwipeLeft = 0;
-                            xmoved = 0;
-                            _device->dispatchKeyboardMessage(kPS2M_swipeRight, &now_abs);
+                        if (_frame->xmoved < -swipedx && !_frame->inSwipeRight && !_frame->inSwipe4Right && threefingerhorizswipe) {
+                            _frame->inSwipeRight = 1;
+                            _frame->inSwipeLeft = 0;
+                            _frame->xmoved = 0;
+                            dispatchKeyboardMessageX(kPS2M_swipeRight, &now_abs);
                             break;
                         }
-                        if (xmoved > swipedx && !inSwipeLeft && !inSwipe4Left && threefingerhorizswipe) {
-                            inSwipeLeft = 1;
-                            inSwipeRight = 0;
-                            xmoved = 0;
-                            _device->dispatchKeyboardMessage(kPS2M_swipeLeft, &now_abs);
+                        if (_frame->xmoved > swipedx && !_frame->inSwipeLeft && !_frame->inSwipe4Left && threefingerhorizswipe) {
+                            _frame->inSwipeLeft = 1;
+                            _frame->inSwipeRight = 0;
+                            _frame->xmoved = 0;
+                            dispatchKeyboardMessageX(kPS2M_swipeLeft, &now_abs);
                             break;
                         }
                     }
                     break;
                     
                 case 4: // four fingers
-                    if (last_fingers != fingers) {
+                    if (_frame->last_fingers != fingers) {
                         break;
                     }
                     
                     // Now calculate total movement since 4 fingers down (add to total)
-                    xmoved += lastx-x;
-                    ymoved += y-lasty;
+                    _frame->xmoved += _frame->lastx-x;
+                    _frame->ymoved += y-_frame->lasty;
                     
                     // dispatching 4 finger movement
-                    if (ymoved > swipedy && !inSwipe4Up) {
-                        inSwipe4Up = 1; inSwipeUp = 0;
-                        inSwipe4Down = 0;
-                        ymoved = 0;
-                        _device->dispatchKeyboardMessage(kPS2M_swipe4Up, &now_abs);
+                    if (_frame->ymoved > swipedy && !_frame->inSwipe4Up) {
+                        _frame->inSwipe4Up = 1; _frame->inSwipeUp = 0;
+                        _frame->inSwipe4Down = 0;
+                        _frame->ymoved = 0;
+                        dispatchKeyboardMessageX(kPS2M_swipe4Up, &now_abs);
                         break;
                     }
-                    if (ymoved < -swipedy && !inSwipe4Down) {
-                        inSwipe4Down = 1; inSwipeDown = 0;
-                        inSwipe4Up = 0;
-                        ymoved = 0;
-                        _device->dispatchKeyboardMessage(kPS2M_swipe4Down, &now_abs);
+                    if (_frame->ymoved < -swipedy && !_frame->inSwipe4Down) {
+                        _frame->inSwipe4Down = 1; _frame->inSwipeDown = 0;
+                        _frame->inSwipe4Up = 0;
+                        _frame->ymoved = 0;
+                        dispatchKeyboardMessageX(kPS2M_swipe4Down, &now_abs);
                         break;
                     }
-                    if (xmoved < -swipedx && !inSwipe4Right) {
-                        inSwipe4Right = 1; inSwipeRight = 0;
-                        inSwipe4Left = 0;
-                        xmoved = 0;
-                        _device->dispatchKeyboardMessage(kPS2M_swipe4Right, &now_abs);
+                    if (_frame->xmoved < -swipedx && !_frame->inSwipe4Right) {
+                        _frame->inSwipe4Right = 1; _frame->inSwipeRight = 0;
+                        _frame->inSwipe4Left = 0;
+                        _frame->xmoved = 0;
+                        dispatchKeyboardMessageX(kPS2M_swipe4Right, &now_abs);
                         break;
                     }
-                    if (xmoved > swipedx && !inSwipe4Left) {
-                        inSwipe4Left = 1; inSwipeLeft = 0;
-                        inSwipe4Right = 0;
-                        xmoved = 0;
-                        _device->dispatchKeyboardMessage(kPS2M_swipe4Left, &now_abs);
+                    if (_frame->xmoved > swipedx && !_frame->inSwipe4Left) {
+                        _frame->inSwipe4Left = 1; _frame->inSwipeLeft = 0;
+                        _frame->inSwipe4Right = 0;
+                        _frame->xmoved = 0;
+                        dispatchKeyboardMessageX(kPS2M_swipe4Left, &now_abs);
                         break;
                     }
             }
@@ -3134,7 +3799,7 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
             buttons |= 0x1;
             // fall through
         case MODE_PREDRAG:
-            if (!immediateclick && (!palm_wt || now_ns - keytime >= maxaftertyping)) {
+            if (!immediateclick && (!palm_wt || now_ns - _frame->keytime >= maxaftertyping)) {
                 buttons |= 0x1;
             }
         case MODE_NOTOUCH:
@@ -3147,58 +3812,64 @@ void ALPS::dispatchEventsWithInfo(int xraw, int yraw, int z, int fingers, UInt32
     // capture time of tap, and watch for double/triple tap
     if (isFingerTouch(z)) {
         // taps don't count if too close to typing or if currently in momentum scroll
-        if ((!palm_wt || now_ns - keytime >= maxaftertyping) && !momentumscrollcurrent) {
+        if ((!palm_wt || now_ns - _frame->keytime >= maxaftertyping) && !_frame->momentumscrollcurrent) {
             
             if (!isTouchMode()) {
-                touchtime = now_ns;
+                _frame->touchtime = now_ns;
             }
             
-            if (last_fingers < fingers) {
-                touchx = x;
-                touchy = y;
+            if (_frame->last_fingers < fingers) {
+                _frame->touchx = x;
+                _frame->touchy = y;
             }
             
             DEBUG_LOG("PS2:Checking Fingers");
-            wasdouble = fingers == 2 || (wasdouble && last_fingers != fingers);// && !scrolldebounce;
-            wastriple = fingers == 3 || (wastriple && last_fingers != fingers);// && !scrolldebounce;
+            _frame->wasdouble = fingers == 2 || (_frame->wasdouble && _frame->last_fingers != fingers);// && !scrolldebounce;
+            _frame->wastriple = fingers == 3 || (_frame->wastriple && _frame->last_fingers != fingers);// && !scrolldebounce;
         }
         
-        if(!scrolldebounce && momentumscrollcurrent){
+        if(!_frame->scrolldebounce && _frame->momentumscrollcurrent){
             // any touch cancels momentum scroll
-            momentumscrollcurrent = 0;
+            _frame->momentumscrollcurrent = 0;
             setTimerTimeout(scrollDebounceTIMER,scrollexitdelay);
-            scrolldebounce = true;
+            _frame->scrolldebounce = true;
         }
     }
     // switch modes, depending on input
-    if (touchmode == MODE_PREDRAG && isFingerTouch(z)) {
-        touchmode = MODE_DRAG;
-        draglocktemp = _modifierdown & draglocktempmask;
+    if (_frame->touchmode == MODE_PREDRAG && isFingerTouch(z)) {
+        _frame->touchmode = MODE_DRAG;
+        _frame->draglocktemp = _modifierdown & draglocktempmask;
     }
-    if (touchmode == MODE_DRAGNOTOUCH && isFingerTouch(z)) {
+    if (_frame->touchmode == MODE_DRAGNOTOUCH && isFingerTouch(z)) {
         if (dragTimer)
             cancelTimer(dragTimer);
-        touchmode=MODE_DRAGLOCK;
+        _frame->touchmode=MODE_DRAGLOCK;
     }
-    if (MODE_MTOUCH != touchmode && fingers > 1 && isFingerTouch(z)) {
-        touchmode = MODE_MTOUCH;
+    if (MODE_MTOUCH != _frame->touchmode && fingers > 1 && isFingerTouch(z)) {
+        _frame->touchmode = MODE_MTOUCH;
     }
     
-    if (touchmode == MODE_NOTOUCH && z > z_finger && !scrolldebounce) {
-        touchmode = MODE_MOVE;
+    if (_frame->touchmode == MODE_NOTOUCH && z > z_finger && !_frame->scrolldebounce) {
+        _frame->touchmode = MODE_MOVE;
     }
     
+    if (tm1 != _frame->touchmode)
+        telemetry(kPS2TE_Gesture, _frame->touchmode, tm1, fingers);
+    
     // dispatch dx/dy and current button status
+    dx += predx;
+    dy += predy;
     dispatchRelativePointerEventX(dx / divisorx, dy / divisory, buttons, now_abs);
+    telemetryDispatch(buttons, dx / divisorx, dy / divisory);
     
     // always save last seen position for calculating deltas later
-    lastx = x;
-    lasty = y;
+    _frame->lastx = x;
+    _frame->lasty = y;
     //b4last = last_fingers;
-    last_fingers = fingers;
+    _frame->last_fingers = fingers;
     
 #ifdef DEBUG
-    DEBUG_LOG("ps2: fingers=%d, dx=%d, dy=%d (%d,%d) z=%d mode=(%d,%d,%d) buttons=%d wasdouble=%d wastriple=%d\n", fingers, dx, dy, x, y, z, tm1, tm2, touchmode, buttons, wasdouble, wastriple);
+    DEBUG_LOG("ps2: fingers=%d, dx=%d, dy=%d (%d,%d) z=%d mode=(%d,%d,%d) buttons=%d wasdouble=%d wastriple=%d\n", fingers, dx, dy, x, y, z, tm1, tm2, _frame->touchmode, buttons, _frame->wasdouble, _frame->wastriple);
 #endif
 }
 
@@ -3209,7 +3880,9 @@ dispatchRelativePointerEventWithPacket(UInt8 *packet,
                                        UInt32 packetSize) {
     //
     // Process the three byte relative format packet that was retrieved from the
-    // trackpad. The format of the bytes is as follows:
+    // passthrough port. This is the hot path for external mice and sticks, so
+    // no logging here and none of the touchpad gesture state is involved.
+    // The format of the bytes is as follows:
     //
     //  7  6  5  4  3  2  1  0
     // -----------------------
@@ -3235,8 +3908,13 @@ dispatchRelativePointerEventWithPacket(UInt8 *packet,
         dy = ((packet[0] << 3) & 0x100) - packet[2];
     }
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
-    IOLog("ALPS: Dispatch relative PS2 packet: dx=%d, dy=%d, buttons=%d\n", dx, dy, buttons);
+    uint64_t now_abs = _frame->_packetTime;
+    
+    // middle button held turns the stick/mouse into a scroll wheel
+    if (mousemiddlescroll && (buttons & 0x4)) {
+        dispatchScrollWheelEventX(scrollLines(-dy), scrollLines(-dx), 0, now_abs);
+        return;
+    }
     dispatchRelativePointerEventX(dx, dy, buttons, now_abs);
+    telemetryDispatch(buttons, dx, dy);
 }
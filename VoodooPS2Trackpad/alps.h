@@ -184,6 +184,16 @@ struct input_mt_pos {
     UInt32 y;
 };
 
+/*
+ * A contact followed from frame to frame on the semi-MT (bitmap)
+ * protocols, see alps_track_contact. An id of 0 means no contact.
+ */
+struct alps_contact {
+    int id;
+    int x, y;
+    int vx, vy;     /* per frame */
+};
+
 /**
  * struct alps_fields - decoded version of the report packet
  * @x_map: Bitmap of active X positions for MT.
@@ -247,29 +257,36 @@ class ALPS;
  * @quirks: Bitmap of ALPS_QUIRK_*.
  */
 struct alps_data {
-    /* these are autodetected when the device is identified */
-    const struct alps_nibble_commands *nibble_commands;
-    SInt32 addr_command;
+    /*
+     * Ordered so the fields the packet decoders read come first and share
+     * a few cache lines; what is only used while identifying or setting up
+     * the device follows.
+     */
     UInt16 proto_version;
     UInt8 byte0, mask0;
-    UInt8 fw_ver[3];
     int flags;
     SInt32 x_max;
     SInt32 y_max;
     SInt32 x_bits;
     SInt32 y_bits;
-    unsigned int x_res;
-    unsigned int y_res;
+    UInt8 quirks;
+    bool PSMOUSE_BAD_DATA;
+    int pktsize = 6;
     
     SInt32 prev_fin;
     SInt32 multi_packet;
     int second_touch;
     UInt8 multi_data[6];
-    struct alps_fields f;
-    UInt8 quirks;
-    bool PSMOUSE_BAD_DATA;
+    struct alps_contact contact;        /* st, see alps_track_primary */
+    int contact_id;                     /* last id handed out */
     
-    int pktsize = 6;
+    /* these are autodetected when the device is identified */
+    const struct alps_nibble_commands *nibble_commands;
+    SInt32 addr_command;
+    UInt8 fw_ver[3];
+    unsigned int x_res;
+    unsigned int y_res;
+    struct alps_fields f;
 };
 
 // Pulled out of alps_data, now saved as vars on class
@@ -321,6 +338,61 @@ protected:
     
     UInt8 _multiData[6];
     
+    // fast suspend: status read at sleep, compared on wake
+    bool _suspendedFast;
+    ALPSStatus_t _suspendStatus;
+    
+    // last touchpad packet had no fingers and no buttons (see packetReady)
+    bool _packetIdle;
+    
+    // the primary contact continued through the last frame (see alps_track_primary)
+    bool _contactKept;
+    
+    // set by recoverDevice, interruptOccurred then hunts for a first byte
+    volatile bool _resyncPending;
+    
+    // hot path log sites (see PS2EventLog)
+    enum
+    {
+        kLogBadPacket,
+        kLogTrackstickRejected,
+    };
+    
+    // decode statistics, counted on the workloop (see publishDecodeStats)
+    enum
+    {
+        kStatV1V2,
+        kStatPosition,          // V3/V5 position packet
+        kStatBitmap,            // V3/V5 bitmap packet following a position packet
+        kStatMPRestart,         // position packet where a bitmap packet was due
+        kStatMPOrphan,          // is_mp reject: bitmap packet without a position packet
+        kStatBitmapEmpty,       // alps_process_bitmap returned 0
+        kStatV3Stick,
+        kStatV4Packets,
+        kStatV4Complete,        // third packet of a V4 bitmap
+        kStatV6Touchpad,
+        kStatV6Stick,
+        kStatV7Idle,            // V7 packet ids, in V7_PACKET_ID order
+        kStatV7Two,
+        kStatV7Multi,
+        kStatV7New,
+        kStatV7Unknown,
+        kStatV7Stick,
+        kStatSS4Idle,           // SS4 packet ids, in SS4_PACKET_ID order
+        kStatSS4One,
+        kStatSS4Two,
+        kStatSS4Multi,
+        kStatSS4Stick,
+        kStatSS4Orphan,         // is_mp reject: second packet without a first
+        kStatCount
+    };
+    enum { kDecodeSampleInterval = 64 };    // power of 2
+    UInt32 _decodeStats[kStatCount];
+    UInt32 _decodePackets;
+    UInt32 _decodeSamples;
+    uint64_t _decodeTime;                   // sampled process_packet time (abs)
+    uint64_t _decodeTimeMax;
+    
     IOGBounds _bounds;
     
     virtual bool deviceSpecificInit();
@@ -331,6 +403,10 @@ protected:
     
     int alps_process_bitmap(struct alps_data *priv, struct alps_fields *f);
     
+    bool alps_track_contact(struct alps_data *priv, struct alps_contact *c, int x, int y, int gate);
+    
+    void alps_track_primary(int x, int y, int fingers);
+    
     void alps_process_trackstick_packet_v3(UInt8 * packet);
     
     bool alps_decode_buttons_v3(struct alps_fields *f, UInt8 *p);
@@ -375,8 +451,28 @@ protected:
     
     void setTouchPadEnable(bool enable);
     
+    virtual bool setReportRate(int rate, bool wait);
+    
+    virtual bool recoverDevice(int level);
+    
+    virtual void publishDecodeStats();
+    
+    virtual void runDecodeBench();
+    
+    virtual void runDecodeCheck();
+    
+    uint64_t benchDispatch(UInt8* stream, size_t length, TouchPadFrame* frame, unsigned* dispatched);
+    
+    bool benchModel(struct ALPSEncoderModel* model);
+    
+    void benchFrame(const struct ALPSEncoderModel& model, UInt32* seed, struct ALPSEncoderFrame* frame);
+    
+    bool checkFrame(const struct ALPSEncoderModel& model, const struct ALPSEncoderFrame& frame, UInt8* p, size_t length);
+    
     PS2InterruptResult interruptOccurred(UInt8 data);
     
+    PS2InterruptResult alps_handle_interleaved_ps2(UInt8 *packet);
+    
     void packetReady();
     
     bool alps_command_mode_send_nibble(int value);
@@ -391,6 +487,9 @@ protected:
     
     bool alps_rpt_cmd(SInt32 init_command, SInt32 init_arg, SInt32 repeated_command, ALPSStatus_t *report);
     
+    bool alps_command_report(UInt8 *commands, int count, ALPSStatus_t *report);
+    UInt32 _reportTimeoutMS;    // read budget for alps_command_report, 0 for the default
+    
     bool alps_enter_command_mode();
     
     bool alps_exit_command_mode();
@@ -0,0 +1,467 @@
+//
+//  alps_encoder.h
+//  VoodooPS2Trackpad
+//
+//  Synthetic ALPS packets: the inverse of the decoders in alps.cpp.  Turns
+//  contact frames into the byte stream the device would send, so decoder
+//  changes can be load tested and round-trip checked off the hardware
+//  (ALPS::runDecodeBench and ALPS::runDecodeCheck).  Plain C++ only, no
+//  kernel headers.
+//
+
+#ifndef VoodooPS2Trackpad_alps_encoder_h
+#define VoodooPS2Trackpad_alps_encoder_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// same values as alps.h
+#ifndef ALPS_PROTO_V1
+#define ALPS_PROTO_V1	0x100
+#define ALPS_PROTO_V2	0x200
+#define ALPS_PROTO_V3	0x300
+#define ALPS_PROTO_V3_RUSHMORE	0x310
+#define ALPS_PROTO_V4	0x400
+#define ALPS_PROTO_V5	0x500
+#define ALPS_PROTO_V6	0x600
+#define ALPS_PROTO_V7		0x700	/* t3btl t4s */
+#define ALPS_PROTO_V8		0x800	/* SS4btl SS4s */
+#endif
+
+#define kALPSEncoderMaxBytes    (3*8)   // longest frame: V4, three 8 byte packets
+
+//
+// What the device is, as set_protocol would have it.  x_bits/y_bits only
+// matter for the bitmap protocols (V3, V4, V5), buttonpad for V7 and V8,
+// interleaved for V2 DualPoints with ALPS_PS2_INTERLEAVED.
+//
+
+struct ALPSEncoderModel
+{
+    uint16_t proto_version;
+    uint8_t byte0;
+    int x_max, y_max;
+    int x_bits, y_bits;
+    bool buttonpad;
+    bool interleaved;
+};
+
+//
+// One report.  Coordinates are in the units of alps_fields, before the
+// y flip done by the process functions, so a frame can be compared with
+// what decode_fields returns.  mt[0] is the primary contact (st for the
+// protocols that have one).  The bitmap protocols only carry the bounding
+// box of the contacts, so only mt[0] and mt[1] are used there.
+//
+
+struct ALPSEncoderFrame
+{
+    int fingers;
+    int pressure;
+    struct { int x, y; } mt[4];
+    unsigned buttons;           // 1 left, 2 right, 4 middle
+
+    // trackstick report instead (fingers and mt are ignored)
+    bool stick;
+    int dx, dy, dz;
+};
+
+class ALPSPacketEncoder
+{
+public:
+    ALPSPacketEncoder(const ALPSEncoderModel& model) : _model(model) {}
+
+    //
+    // Writes the bytes for one frame to out (at least kALPSEncoderMaxBytes)
+    // and returns how many.  Multi-packet frames (V3/V5 bitmaps, V4, V8 with
+    // more than two fingers) come out as the whole sequence.  0 if the
+    // protocol has no encoding for the frame.
+    //
+
+    size_t encode(const ALPSEncoderFrame& f, uint8_t* out)
+    {
+        switch (_model.proto_version)
+        {
+            case ALPS_PROTO_V1:
+            case ALPS_PROTO_V2:
+                return encode_v1_v2(f, out);
+            case ALPS_PROTO_V3:
+            case ALPS_PROTO_V3_RUSHMORE:
+            case ALPS_PROTO_V5:
+                return encode_v3_v5(f, out);
+            case ALPS_PROTO_V4:
+                return encode_v4(f, out);
+            case ALPS_PROTO_V6:
+                return encode_v6(f, out);
+            case ALPS_PROTO_V7:
+                return encode_v7(f, out);
+            case ALPS_PROTO_V8:
+                return encode_ss4_v2(f, out);
+        }
+        return 0;
+    }
+
+    //
+    // Bare 3-byte PS/2 packet, as from a device on the passthrough port.
+    // dx/dy are PS/2 deltas (y up), range -256..255.
+    //
+
+    static size_t encode_relative(int dx, int dy, unsigned buttons, uint8_t* out)
+    {
+        out[0] = 0x08 | (buttons & 0x07) | (dx < 0 ? 0x10 : 0) | (dy < 0 ? 0x20 : 0);
+        out[1] = dx & 0xff;
+        out[2] = dy & 0xff;
+        return 3;
+    }
+
+    //
+    // V2 DualPoint with a PS/2 packet stuffed in the middle of the ALPS one
+    // (see alps_handle_interleaved_ps2).  The low nibble of the PS/2 first
+    // byte is the marker, so it has no room for buttons; those come in the
+    // ALPS packet.
+    //
+
+    size_t encode_interleaved(const ALPSEncoderFrame& f, int dx, int dy, uint8_t* out)
+    {
+        uint8_t alps[6];
+        if (6 != encode_v1_v2(f, alps))
+            return 0;
+        encode_relative(dx, dy, 0, out + 3);
+        out[3] |= 0x07;
+        out[0] = alps[0]; out[1] = alps[1]; out[2] = alps[2];
+        out[6] = alps[3]; out[7] = alps[4]; out[8] = alps[5];
+        return 9;
+    }
+
+private:
+    ALPSEncoderModel _model;
+
+    static inline int clamp(int v, int lo, int hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+    // bitmap bit for a coordinate, the inverse of the corner math in alps_process_bitmap
+    static inline unsigned bitmap_bit(int v, int max, int bits, bool reversed)
+    {
+        v = clamp(v, 0, max);
+        if (reversed)
+            v = max - v;
+        return 1u << ((v * (bits - 1) + max / 2) / max);
+    }
+
+    void bitmaps(const ALPSEncoderFrame& f, uint32_t* x_map, uint32_t* y_map)
+    {
+        bool xrev = ALPS_PROTO_V5 == _model.proto_version;
+        bool yrev = ALPS_PROTO_V3 == _model.proto_version || ALPS_PROTO_V4 == _model.proto_version;
+        *x_map = *y_map = 0;
+        for (int i = 0; i < 2; i++) {
+            *x_map |= bitmap_bit(f.mt[i].x, _model.x_max, _model.x_bits, xrev);
+            *y_map |= bitmap_bit(f.mt[i].y, _model.y_max, _model.y_bits, yrev);
+        }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    size_t encode_v1_v2(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        int x, y, z;
+        if (f.stick) {
+            // z == 127 marks the stick, x above 383 and y above 255 are negative
+            x = clamp(f.dx, -384, 383);
+            if (x < 0) x += 768;
+            y = clamp(-f.dy, -256, 255) & 0x1ff;
+            z = 127;
+        } else {
+            x = clamp(f.mt[0].x, 0, 1023);
+            y = clamp(f.mt[0].y, 0, 767);
+            z = clamp(f.pressure, 0, 126);
+        }
+
+        if (ALPS_PROTO_V1 == _model.proto_version) {
+            p[0] = _model.byte0 | ((x >> 7) & 0x07);
+            p[1] = x & 0x7f;
+            p[2] = (f.buttons & 1 ? 0x10 : 0) | (f.buttons & 2 ? 0x08 : 0);
+            p[3] = (y >> 7) & 0x07;
+            p[4] = y & 0x7f;
+            p[5] = z;
+        } else {
+            p[0] = _model.byte0;
+            p[1] = x & 0x7f;
+            p[2] = (x >> 4) & 0x78;
+            p[3] = ((y >> 3) & 0x70) | (f.buttons & 0x07);
+            p[4] = y & 0x7f;
+            p[5] = z;
+        }
+        return 6;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    size_t encode_v3_v5(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        bool v5 = ALPS_PROTO_V5 == _model.proto_version;
+        bool rushmore = ALPS_PROTO_V3_RUSHMORE == _model.proto_version;
+
+        if (f.stick) {
+            if (v5)
+                return 0;
+            // v3 trackstick: 0x3f in the last byte
+            int x = clamp(f.dx, -128, 127) & 0xff;
+            int y = clamp(-f.dy, -128, 127) & 0xff;
+            p[0] = _model.byte0 | 0x40 | ((x & 0x80) >> 2) | ((y & 0x80) >> 3);
+            p[1] = x & 0x7f;
+            p[2] = y & 0x7f;
+            p[3] = f.buttons & 0x07;
+            p[4] = (clamp(f.dz, 0, 31) << 2) & 0x7c;
+            p[5] = 0x3f;
+            return 6;
+        }
+
+        // position packet (also first of a bitmap sequence)
+        bool mp = f.fingers >= 2;
+        int x = clamp(f.mt[0].x, 0, 0x7ff);
+        int y = clamp(f.mt[0].y, 0, 0x7ff);
+        int z = clamp(f.pressure, 0, rushmore ? 0x3e : 0x7e);
+        if (!v5 && 0x3f == z)
+            z = 0x3e;   // would look like a trackstick packet
+        if (v5) {
+            p[0] = _model.byte0 | (mp ? 0x02 : 0) | (z ? 0 : 0x04);
+            p[1] = x & 0x7f;
+            p[2] = y & 0x7f;
+            p[3] = f.buttons & 0x07;
+            p[4] = ((x >> 7) & 0x0f) | ((y >> 3) & 0xf0);
+            p[5] = z;
+        } else {
+            p[0] = _model.byte0 | ((x & 0x03) << 4);
+            p[1] = (x >> 4) & 0x7f;
+            p[2] = (y >> 4) & 0x7f;
+            p[3] = f.buttons & 0x07;
+            p[4] = (mp ? 0x40 : 0) | ((x & 0x0c) << 2) | (y & 0x0f);
+            p[5] = z;
+        }
+        if (!mp)
+            return 6;
+
+        // bitmap packet
+        uint32_t x_map, y_map;
+        bitmaps(f, &x_map, &y_map);
+        int fingers = clamp(f.fingers, 1, 4) - 1;
+        uint8_t* q = p + 6;
+        if (v5) {
+            uint64_t palm = ((uint64_t)x_map << _model.y_bits) | y_map;
+            int n = fingers + 1;
+            q[0] = _model.byte0 | 0x20 | ((n & 0x03) << 1) | ((n & 0x04) << 2) | ((palm >> 34) & 0x01);
+            q[1] = palm & 0x7f;
+            q[2] = (palm >> 7) & 0x7f;
+            q[3] = ((palm >> 28) & 0x07) | ((palm >> 27) & 0x70);
+            q[4] = (palm >> 14) & 0x7f;
+            q[5] = (palm >> 21) & 0x7f;
+        } else {
+            q[0] = _model.byte0 | (rushmore ? 0 : 0x40) | ((x_map & 0x03) << 4);
+            q[1] = (x_map >> 2) & 0x7f;
+            q[2] = (y_map >> 1) & 0x7f;
+            q[3] = (y_map >> 4) & 0x70;
+            q[4] = ((x_map >> 8) & 0x7e) | (y_map & 0x01);
+            q[5] = rushmore ? 0x40 | ((x_map >> 11) & 0x10) | ((y_map >> 6) & 0x20) | fingers : fingers;
+        }
+        return 12;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    size_t encode_v4(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        //
+        // Each packet carries the position, and a third of the bitmap in
+        // bytes 6 and 7.  The first of three is marked with 0x40 in byte 6.
+        //
+
+        int x = clamp(f.mt[0].x, 0, 0x7ff);
+        int y = clamp(f.mt[0].y, 0, 0x7ff);
+        uint32_t x_map = 0, y_map = 0;
+        if (f.fingers >= 2)
+            bitmaps(f, &x_map, &y_map);
+        uint8_t md[6];
+        md[0] = 0x40 | ((x_map >> 2) & 0x3f);
+        md[1] = ((x_map & 0x03) << 5) | (y_map & 0x1f);
+        md[2] = (x_map >> 10) & 0x1f;
+        md[3] = ((x_map >> 3) & 0x60) | ((y_map >> 5) & 0x1f);
+        md[4] = 0;
+        md[5] = (y_map >> 10) & 0x01;
+
+        for (int i = 0; i < 3; i++, p += 8) {
+            p[0] = _model.byte0 | ((x & 0x03) << 4);
+            p[1] = (x >> 4) & 0x7f;
+            p[2] = (y >> 4) & 0x7f;
+            p[3] = ((x & 0x0c) << 2) | (y & 0x0f);
+            p[4] = f.buttons & 0x03;
+            p[5] = clamp(f.pressure, 0, 0x7f);
+            p[6] = md[2*i];
+            p[7] = md[2*i + 1];
+        }
+        return 24;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    size_t encode_v6(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        p[0] = _model.byte0;
+        if (f.stick) {
+            // trackpoint: 0x7f in the last byte, deltas are 8 bit unsigned
+            int x = f.dx & 0xff, y = f.dy & 0xff;
+            p[1] = x & 0x7f;
+            p[2] = y & 0x7f;
+            p[3] = ((x & 0x80) >> 2) | ((y & 0x80) >> 1) | (f.buttons & 0x07);
+            p[4] = clamp(f.dz, 0, 0x7f);
+            p[5] = 0x7f;
+            return 6;
+        }
+        int x = clamp(f.mt[0].x, 0, 0x7ff);
+        int y = clamp(f.mt[0].y, 0, 0x7ff);
+        p[1] = x & 0x7f;
+        p[2] = y & 0x7f;
+        p[3] = ((x >> 4) & 0x78) | (f.buttons & 0x03);
+        p[4] = (y >> 4) & 0x78;
+        p[5] = clamp(f.pressure, 0, 0x7e);
+        return 6;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    size_t encode_v7(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        if (f.stick) {
+            int x = clamp(f.dx, -128, 127) & 0xff;
+            int y = clamp(-f.dy, -128, 127) & 0xff;
+            int z = clamp(f.dz, 0, 0x7f);
+            p[0] = 0x48;
+            p[1] = f.buttons & 0x07;
+            p[2] = 0x40 | (x & 0xbf);
+            p[3] = 0x48 | (y & 0x07) | ((x & 0x40) >> 2) | ((y & 0x40) >> 1) | ((z & 0x40) << 1);
+            p[4] = 0x06 | (y & 0xb8);
+            p[5] = z & 0x3f;
+            return 6;
+        }
+
+        int fingers = f.fingers;
+        unsigned buttons = _model.buttonpad ? f.buttons & 1 : f.buttons & 0x07;
+        if (!fingers && !buttons) {
+            memset(p, 0, 6);
+            p[0] = 0x48;
+            p[2] = 0x40;
+            p[3] = 0x48;
+            return 6;
+        }
+
+        // raw y is inverted, 0x7ff - y; mt[1] of 0,0 reads as no contact
+        int x0 = 0, y0 = 0x7ff, x1 = 0, y1 = 0x7ff;
+        if (fingers >= 1) {
+            x0 = clamp(f.mt[0].x, 0, 0xfff);
+            y0 = 0x7ff - clamp(f.mt[0].y, 0, 0x7ff);
+        }
+        if (fingers >= 2) {
+            x1 = clamp(f.mt[1].x, 0, 0xfff);
+            y1 = 0x7ff - clamp(f.mt[1].y, 0, 0x7ff);
+            // a TWO contact in the top corners reads as none (x 0) or a false positive (x 0xff0)
+            if (y1 >= 0x7f0)
+                x1 = clamp(x1, 0x10, 0xfef);
+        }
+
+        // a buttonpad has no right/middle, those bits add to the finger count
+        int extra = 0;
+        if (_model.buttonpad && fingers > 2 && fingers <= 4) {
+            extra = fingers - 2;
+            buttons |= extra >= 1 ? 0x02 : 0;
+            buttons |= extra >= 2 ? 0x04 : 0;
+        }
+        
+        p[0] = 0x48 | (y0 & 0x07) | ((buttons & 1) << 7) | ((buttons & 2) << 4) | ((buttons & 4) << 2);
+        p[1] = (y0 >> 3) & 0xff;
+        p[2] = ((x0 >> 4) & 0x80) | 0x40 | ((x0 >> 5) & 0x3f);
+        p[3] = 0x48 | ((x0 << 1) & 0x30) | (x0 & 0x07) | ((x1 >> 4) & 0x80);
+        if (fingers - extra <= 2) {
+            // TWO: x1 bits 4..11, y1 bits 4..10
+            p[4] = 0x40 | ((x1 >> 3) & 0x80) | ((x1 >> 4) & 0x3f);
+            p[5] = ((y1 >> 3) & 0x80) | ((y1 >> 4) & 0x3f);
+        } else {
+            // MULTI: the low bits of byte 5 are the finger count past 3
+            p[4] = 0x01 | ((x1 >> 3) & 0x80) | ((x1 >> 4) & 0x3c) | ((y1 >> 4) & 0x02);
+            p[5] = ((y1 >> 3) & 0x80) | ((y1 >> 4) & 0x3c) | (clamp(fingers, 3, 6) - 3);
+        }
+        return 6;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    // one of the two contacts of an SS4 TWO or MULTI packet, into b[0..2]
+    void encode_ss4_mf(uint8_t* b, int x, int y, bool touch)
+    {
+        x = clamp(x, 0, 0x1fff);
+        y = clamp(y, 0, 0xfff);
+        b[0] |= (x >> 5) & 0x07;
+        b[1] |= ((x >> 5) & 0xf8) | ((y >> 3) & 0x02) | (touch ? 0x05 : 0);
+        b[2] |= ((y >> 5) & 0x0f) | ((y >> 4) & 0xe0);
+        if (_model.buttonpad)
+            b[0] |= ((x << 3) & 0x80) | ((y << 3) & 0x40);
+    }
+
+    size_t encode_ss4_v2(const ALPSEncoderFrame& f, uint8_t* p)
+    {
+        unsigned buttons = _model.buttonpad ? f.buttons & 1 : f.buttons & 0x07;
+        uint8_t b0 = _model.byte0 | (buttons << 5);
+        memset(p, 0, 12);
+
+        if (f.stick) {
+            int x = f.dx & 0xff, y = f.dy & 0xff;
+            p[0] = b0 | ((x >> 7) & 0x01);
+            p[1] = x & 0x7f;
+            p[2] = y & 0x7f;
+            p[3] = 0x08 | 0x20 | ((y >> 7) & 0x01);
+            p[4] = clamp(f.dz, 0, 0x7f);
+            return 6;
+        }
+
+        if (f.fingers <= 1) {
+            if (!f.fingers && !buttons) {
+                // idle
+                p[0] = 0x18; p[1] = 0x10; p[3] = 0x08; p[4] = 0x10;
+                return 6;
+            }
+            int x = f.fingers ? clamp(f.mt[0].x, 0, 0x1fff) : 0;
+            int y = f.fingers ? clamp(f.mt[0].y, 0, 0xfff) : 0;
+            int z = f.fingers ? clamp(f.pressure / 2, 1, 0x3f) : 0;
+            p[0] = b0 | (x & 0x07);
+            p[1] = ((x >> 3) & 0x0f) | ((x >> 2) & 0xe0);
+            p[2] = (y & 0x0f) | ((x >> 5) & 0xe0);
+            p[3] = 0x08 | ((y << 2) & 0xc0);
+            p[4] = ((y >> 6) & 0x0f) | ((y >> 5) & 0x60) | (z & 0x80);
+            p[5] = (z & 0x0f) | ((z << 1) & 0xe0);
+            return 6;
+        }
+
+        // TWO, followed by MULTI for three or more
+        bool more = f.fingers > 2;
+        p[0] = b0;
+        p[3] = 0x08 | 0x10;
+        encode_ss4_mf(p, f.mt[0].x, f.mt[0].y, true);
+        encode_ss4_mf(p + 3, f.mt[1].x, f.mt[1].y, true);
+        if (more)
+            p[2] |= 0x10;
+        if (!more)
+            return 6;
+
+        uint8_t* q = p + 6;
+        q[0] = b0;
+        q[3] = 0x08 | 0x30;
+        encode_ss4_mf(q, f.mt[2].x, f.mt[2].y, true);
+        if (f.fingers >= 4)
+            encode_ss4_mf(q + 3, f.mt[3].x, f.mt[3].y, true);
+        else
+            encode_ss4_mf(q + 3, 0x1fff, 0xfff, false);
+        if (f.fingers >= 5)
+            q[2] |= 0x10;
+        return 12;
+    }
+};
+
+#endif // VoodooPS2Trackpad_alps_encoder_h